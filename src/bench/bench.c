@@ -0,0 +1,214 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  bench [-r RUNS] [-t SECS] [-f FORKTRACE] [-d DIR] [-- FORKTRACE-ARGS...]
+ *
+ *      Runs each of the workloads in DIR (by default, wherever this program
+ *      is) on its own and then under forktrace (in non-interactive mode, with
+ *      any extra FORKTRACE-ARGS), and prints how long each took as CSV. Each
+ *      one is run RUNS times and the fastest time is the one that counts, since
+ *      anything slower than that is just noise from the rest of the system.
+ */
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "bench.h"
+
+/* The most arguments that we'll ever pass to forktrace. */
+#define MAX_ARGS 64
+
+/* A workload, the arguments that we run it with, and how many processes that
+ * makes it create (counting itself). See each of the src/bench/ programs. */
+struct workload
+{
+    const char* name;
+    const char* args[3];
+    long processes;
+};
+
+static const struct workload WORKLOADS[] = {
+    { "fanout",   { "200" },           201 },
+    { "chain",    { "100" },           101 },
+    { "syscalls", { "4", "20000" },    5 },
+    { "orphans",  { "100" },           201 },
+    { "pingpong", { "2000" },          2 },
+    { "bigargv",  { "50", "2000" },    51 },
+};
+
+#define WORKLOAD_COUNT (sizeof(WORKLOADS) / sizeof(WORKLOADS[0]))
+
+/* Set by the SIGALRM handler when a run takes longer than the time limit. */
+static volatile sig_atomic_t timedOut = 0;
+
+static void on_alarm(int sig)
+{
+    (void)sig;
+    timedOut = 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs the command (with its output thrown away) and returns how long it took
+ * in seconds. Returns a negative number if it failed or went over the time
+ * limit (in which case everything that it started gets killed). */
+static double run(char** cmd, unsigned limit)
+{
+    double start = now();
+    pid_t pid = xfork();
+    if (pid == 0)
+    {
+        // Put it in its own process group so we can kill all of it if needed.
+        setpgid(0, 0);
+        int null = open("/dev/null", O_RDWR);
+        if (null != -1)
+        {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execv(cmd[0], cmd);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+
+    timedOut = 0;
+    alarm(limit);
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            die("waitpid");
+        }
+        if (timedOut)
+        {
+            kill(-pid, SIGKILL);
+        }
+    }
+    alarm(0);
+    double elapsed = now() - start;
+    if (timedOut)
+    {
+        kill(-pid, SIGKILL); // in case anything outlived it
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return -1;
+    }
+    return elapsed;
+}
+
+/* Runs it the given number of times and returns the fastest, or a negative
+ * number if any of them failed. */
+static double best_of(char** cmd, unsigned limit, int runs)
+{
+    double best = -1;
+    for (int i = 0; i < runs; ++i)
+    {
+        double t = run(cmd, limit);
+        if (t < 0)
+        {
+            return -1;
+        }
+        if (best < 0 || t < best)
+        {
+            best = t;
+        }
+    }
+    return best;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-r RUNS] [-t SECS] [-f FORKTRACE] [-d DIR] "
+        "[-- FORKTRACE-ARGS...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int runs = 3;
+    unsigned limit = 60;
+    const char* forktrace = "./forktrace";
+    char self[PATH_MAX] = ".";
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len != -1)
+    {
+        self[len] = '\0';
+    }
+    const char* dir = dirname(self);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:f:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': runs = atoi(optarg); break;
+        case 't': limit = atoi(optarg); break;
+        case 'f': forktrace = optarg; break;
+        case 'd': dir = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (runs < 1 || argc - optind > MAX_ARGS - 8)
+    {
+        usage(argv[0]);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_alarm; // no SA_RESTART, so that waitpid gets EINTR
+    sigaction(SIGALRM, &sa, NULL);
+
+    printf("workload,processes,untraced_s,traced_s,untraced_procs_per_s,"
+        "traced_procs_per_s,slowdown,status\n");
+    int failures = 0;
+    for (size_t i = 0; i < WORKLOAD_COUNT; ++i)
+    {
+        const struct workload* w = &WORKLOADS[i];
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, w->name);
+
+        // forktrace -c [FORKTRACE-ARGS...] <path> <args...>
+        char* cmd[MAX_ARGS];
+        int n = 0;
+        cmd[n++] = (char*)forktrace;
+        cmd[n++] = "-c";
+        for (int j = optind; j < argc; ++j)
+        {
+            cmd[n++] = argv[j];
+        }
+        char** workload = &cmd[n];
+        cmd[n++] = path;
+        for (int j = 0; j < 3 && w->args[j]; ++j)
+        {
+            cmd[n++] = (char*)w->args[j];
+        }
+        cmd[n] = NULL;
+
+        double untraced = best_of(workload, limit, runs);
+        double traced = untraced < 0 ? -1 : best_of(cmd, limit, runs);
+        if (untraced < 0 || traced < 0)
+        {
+            printf("%s,%ld,,,,,,%s\n", w->name, w->processes,
+                untraced < 0 ? "untraced-failed" : "traced-failed");
+            failures++;
+        }
+        else
+        {
+            printf("%s,%ld,%.6f,%.6f,%.1f,%.1f,%.3f,ok\n", w->name,
+                w->processes, untraced, traced, w->processes / untraced,
+                w->processes / traced, traced / untraced);
+        }
+        fflush(stdout);
+    }
+    return failures == 0 ? 0 : 1;
+}
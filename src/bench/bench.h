@@ -0,0 +1,61 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  bench
+ *
+ *      Little helpers shared by the benchmark workloads (and the driver). The
+ *      workloads are plain C programs that each stress one thing that costs
+ *      the tracer something (forks, execs, syscall stops, orphans, signals).
+ */
+#ifndef FORKTRACE_BENCH_H
+#define FORKTRACE_BENCH_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Prints what went wrong (with errno) and exits. */
+static inline void die(const char* msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+    /* NOTREACHED */
+}
+
+/* Gets the i'th command line argument as a number, or `def` if there isn't
+ * one. Every workload takes its sizes this way, so that the driver can say
+ * exactly how many processes it's going to make. */
+static inline long arg(int argc, char** argv, int i, long def)
+{
+    return i < argc ? strtol(argv[i], NULL, 10) : def;
+}
+
+/* Forks, or dies trying. */
+static inline pid_t xfork(void)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        die("fork");
+    }
+    return pid;
+}
+
+/* Waits for all of our children to finish. */
+static inline void reap_all(void)
+{
+    int status;
+    while (wait(&status) != -1 || errno == EINTR)
+    {
+        continue;
+    }
+    if (errno != ECHILD)
+    {
+        die("wait");
+    }
+}
+
+#endif /* FORKTRACE_BENCH_H */
@@ -0,0 +1,49 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  bigargv [N] [ARGS]
+ *
+ *      Forks N children that each exec this program again with ARGS extra
+ *      arguments of 64 characters each (like a compiler invocation with a lot
+ *      of flags, or xargs). The tracer reads the whole argv out of the tracee
+ *      for each exec, so this is what that costs. Makes N+1 processes.
+ */
+#include "bench.h"
+
+#define ARG_LENGTH 64
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+    {
+        return 0;
+    }
+    long n = arg(argc, argv, 1, 50);
+    long count = arg(argc, argv, 2, 1000);
+
+    char** args = calloc(count + 3, sizeof(char*));
+    char* strings = malloc(count * (ARG_LENGTH + 1));
+    if (!args || !strings)
+    {
+        die("malloc");
+    }
+    args[0] = argv[0];
+    args[1] = "child";
+    for (long i = 0; i < count; ++i)
+    {
+        char* str = strings + i * (ARG_LENGTH + 1);
+        snprintf(str, ARG_LENGTH + 1, "--argument-%0*ld", ARG_LENGTH - 11, i);
+        args[i + 2] = str;
+    }
+    args[count + 2] = NULL;
+
+    for (long i = 0; i < n; ++i)
+    {
+        if (xfork() == 0)
+        {
+            execv("/proc/self/exe", args);
+            die("exec");
+        }
+    }
+    reap_all();
+    return 0;
+}
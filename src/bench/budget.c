@@ -0,0 +1,178 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  budget [-f FORKTRACE] [-d DIR]
+ *
+ *      Runs each scenario (see scenario.c) under forktrace --stats and checks
+ *      how many stops, ptrace calls and other memory syscalls it cost against
+ *      a budget. Unlike the timings from bench.c, these counts are the same on
+ *      every run (and every machine with the same kernel features), so they
+ *      catch things like someone going back to reading argv one word at a
+ *      time, or adding an extra stop to every fork.
+ *
+ *      Everything is counted relative to the "none" scenario, so the cost of
+ *      starting the tracee up doesn't get in the way. Prints CSV, and exits
+ *      with a non-zero status if anything went over its budget. A scenario
+ *      that comes in under its budget still passes, but it's marked "under"
+ *      so that the budget can be brought down to match.
+ *
+ *      The budgets assume the default options (the seccomp filter and the
+ *      reaper process) and a kernel with PTRACE_GET_SYSCALL_INFO and
+ *      process_vm_readv.
+ */
+#include <limits.h>
+#include <libgen.h>
+
+#include "bench.h"
+
+/* The counts that we care about from the output of --stats. */
+struct counts
+{
+    long stops;
+    long ptraceCalls;
+    long memoryCalls;
+};
+
+/* A scenario, the arguments that we run it with, and its budget. */
+struct scenario
+{
+    const char* name;
+    const char* args;
+    struct counts budget;
+};
+
+static const struct scenario SCENARIOS[] = {
+    { "fork",       "fork",         { 8, 13, 1 } },
+    { "wait-null",  "wait-null",    { 8, 13, 0 } },
+    { "exec-10",    "exec 10",      { 3, 6, 3 } },
+    { "exec-1000",  "exec 1000",    { 3, 6, 5 } },
+    { "kill",       "kill",         { 3, 6, 0 } },
+};
+
+#define SCENARIO_COUNT (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+/* Runs the scenario program (with the given arguments) under forktrace, and
+ * gets the counts out of what --stats prints. Returns 0 on failure. */
+static int measure(const char* forktrace, const char* scenario,
+                   const char* args, struct counts* counts)
+{
+    char cmd[2 * PATH_MAX + 128];
+    snprintf(cmd, sizeof(cmd), "'%s' -c --stats '%s' %s 2>&1 >/dev/null",
+        forktrace, scenario, args);
+    FILE* out = popen(cmd, "r");
+    if (!out)
+    {
+        die("popen");
+    }
+
+    // The memory syscalls are the indented lines after "other memory ...".
+    memset(counts, 0, sizeof(*counts));
+    int found = 0;
+    int inMemory = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), out))
+    {
+        long n;
+        if (sscanf(line, "wait notifications: %ld", &n) == 1)
+        {
+            counts->stops = n;
+            found++;
+        }
+        else if (sscanf(line, "ptrace calls: %ld", &n) == 1)
+        {
+            counts->ptraceCalls = n;
+            found++;
+        }
+        else if (strncmp(line, "other memory syscalls:", 22) == 0)
+        {
+            inMemory = 1;
+            found++;
+        }
+        else if (inMemory && line[0] == ' ')
+        {
+            char* last = strrchr(line, ' ');
+            counts->memoryCalls += strtol(last, NULL, 10);
+        }
+        else
+        {
+            inMemory = 0;
+        }
+    }
+    int status = pclose(out);
+    return found == 3 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-f FORKTRACE] [-d DIR]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* forktrace = "./forktrace";
+    char self[PATH_MAX] = ".";
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len != -1)
+    {
+        self[len] = '\0';
+    }
+    const char* dir = dirname(self);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f': forktrace = optarg; break;
+        case 'd': dir = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    char scenario[PATH_MAX];
+    snprintf(scenario, sizeof(scenario), "%s/scenario", dir);
+    struct counts base;
+    if (!measure(forktrace, scenario, "none", &base))
+    {
+        fprintf(stderr, "budget: couldn't run the \"none\" scenario\n");
+        return 1;
+    }
+
+    printf("scenario,stops,stops_budget,ptrace_calls,ptrace_calls_budget,"
+        "memory_calls,memory_calls_budget,status\n");
+    int failures = 0;
+    for (size_t i = 0; i < SCENARIO_COUNT; ++i)
+    {
+        const struct scenario* s = &SCENARIOS[i];
+        struct counts c;
+        if (!measure(forktrace, scenario, s->args, &c))
+        {
+            printf("%s,,%ld,,%ld,,%ld,failed\n", s->name, s->budget.stops,
+                s->budget.ptraceCalls, s->budget.memoryCalls);
+            failures++;
+            continue;
+        }
+        c.stops -= base.stops;
+        c.ptraceCalls -= base.ptraceCalls;
+        c.memoryCalls -= base.memoryCalls;
+
+        const char* status = "ok";
+        if (c.stops > s->budget.stops
+            || c.ptraceCalls > s->budget.ptraceCalls
+            || c.memoryCalls > s->budget.memoryCalls)
+        {
+            status = "over";
+            failures++;
+        }
+        else if (c.stops < s->budget.stops
+            || c.ptraceCalls < s->budget.ptraceCalls
+            || c.memoryCalls < s->budget.memoryCalls)
+        {
+            status = "under";
+        }
+        printf("%s,%ld,%ld,%ld,%ld,%ld,%ld,%s\n", s->name, c.stops,
+            s->budget.stops, c.ptraceCalls, s->budget.ptraceCalls,
+            c.memoryCalls, s->budget.memoryCalls, status);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  chain [N]
+ *
+ *      Each process forks one child and waits for it, N levels deep. This makes
+ *      the tree as deep as it can be, which is the worst case for anything in
+ *      the tracer that walks up or down it. Makes N+1 processes.
+ */
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    long n = arg(argc, argv, 1, 100);
+    for (long depth = 0; depth < n; ++depth)
+    {
+        if (xfork() != 0)
+        {
+            reap_all();
+            return 0;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  fanout [N]
+ *
+ *      Forks N children that each exec (a fresh copy of) this program, which
+ *      exits straight away, and waits for them all. This is the bread and
+ *      butter of a build system: fork, exec, exit, reap. Makes N+1 processes.
+ */
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+    {
+        return 0;
+    }
+    long n = arg(argc, argv, 1, 100);
+    for (long i = 0; i < n; ++i)
+    {
+        if (xfork() == 0)
+        {
+            execl("/proc/self/exe", argv[0], "child", (char*)NULL);
+            die("exec");
+        }
+    }
+    reap_all();
+    return 0;
+}
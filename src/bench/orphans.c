@@ -0,0 +1,31 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  orphans [N]
+ *
+ *      Forks N children that each fork a grandchild and then exit straight
+ *      away, so all of the grandchildren get orphaned (and go to the reaper,
+ *      or to forktrace with --subreaper). Makes 2N+1 processes.
+ */
+#include <time.h>
+
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    long n = arg(argc, argv, 1, 50);
+    for (long i = 0; i < n; ++i)
+    {
+        if (xfork() == 0)
+        {
+            if (xfork() == 0)
+            {
+                // Give our parent a chance to exit first.
+                struct timespec delay = { 0, 1000000 };
+                nanosleep(&delay, NULL);
+            }
+            return 0;
+        }
+    }
+    reap_all();
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  pingpong [ROUNDS]
+ *
+ *      A parent and a child that take turns sending each other SIGUSR1, for
+ *      ROUNDS round trips. Every signal means a signal-delivery-stop and a
+ *      kill syscall for the tracer to look at. Makes 2 processes.
+ */
+#include <signal.h>
+
+#include "bench.h"
+
+static void handler(int sig)
+{
+    (void)sig;
+}
+
+/* Sends the signal to `other` and waits for it to send one back. */
+static void volley(pid_t other, const sigset_t* unblocked)
+{
+    if (kill(other, SIGUSR1) == -1)
+    {
+        die("kill");
+    }
+    sigsuspend(unblocked);
+}
+
+int main(int argc, char** argv)
+{
+    long rounds = arg(argc, argv, 1, 1000);
+
+    // Block it outside of sigsuspend so that none of them go missing.
+    sigset_t blocked, unblocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &blocked, &unblocked);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    pid_t parent = getpid();
+    pid_t child = xfork();
+    if (child == 0)
+    {
+        sigsuspend(&unblocked);
+        for (long i = 1; i < rounds; ++i)
+        {
+            volley(parent, &unblocked);
+        }
+        kill(parent, SIGUSR1);
+        return 0;
+    }
+    for (long i = 0; i < rounds; ++i)
+    {
+        volley(child, &unblocked);
+    }
+    reap_all();
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  scenario NAME [N]
+ *
+ *      Does exactly one of the things that the tracer has to deal with, so
+ *      that the budget driver (see budget.c) can count how many stops and
+ *      ptrace calls it costs. The scenarios are:
+ *
+ *          none        does nothing (what everything else is compared to)
+ *          fork        forks a child that exits, and waits for it
+ *          wait-null   same as fork, but waits with a NULL status pointer
+ *          exec N      execs itself (as "none") with N extra arguments
+ *          kill        sends itself a (handled) SIGUSR1
+ */
+#include <signal.h>
+
+#include "bench.h"
+
+static void handler(int sig)
+{
+    (void)sig;
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = argc > 1 ? argv[1] : "none";
+    if (strcmp(name, "none") == 0)
+    {
+        return 0;
+    }
+    if (strcmp(name, "fork") == 0 || strcmp(name, "wait-null") == 0)
+    {
+        pid_t child = xfork();
+        if (child == 0)
+        {
+            _exit(0);
+        }
+        int status;
+        int* ptr = strcmp(name, "fork") == 0 ? &status : NULL;
+        if (waitpid(child, ptr, 0) == -1)
+        {
+            die("waitpid");
+        }
+        return 0;
+    }
+    if (strcmp(name, "exec") == 0)
+    {
+        long n = arg(argc, argv, 2, 0);
+        char** args = calloc(n + 3, sizeof(char*));
+        if (!args)
+        {
+            die("calloc");
+        }
+        args[0] = argv[0];
+        args[1] = "none";
+        for (long i = 0; i < n; ++i)
+        {
+            args[i + 2] = "an-argument";
+        }
+        execv("/proc/self/exe", args);
+        die("exec");
+    }
+    if (strcmp(name, "kill") == 0)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handler;
+        sigaction(SIGUSR1, &sa, NULL);
+        kill(getpid(), SIGUSR1);
+        return 0;
+    }
+    fprintf(stderr, "unknown scenario: %s\n", name);
+    return 2;
+}
@@ -0,0 +1,39 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  syscalls [N] [CALLS]
+ *
+ *      Forks N children that each make CALLS cheap syscalls before exiting.
+ *      Most of them are ones that the seccomp filter lets through, but every
+ *      tenth one is a kill (with no signal) that it stops for. So this shows
+ *      up both the cost of a syscall-stop and how much the filter saves us.
+ *      Makes N+1 processes.
+ */
+#include <signal.h>
+
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    long n = arg(argc, argv, 1, 4);
+    long calls = arg(argc, argv, 2, 10000);
+    for (long i = 0; i < n; ++i)
+    {
+        if (xfork() == 0)
+        {
+            for (long j = 0; j < calls; ++j)
+            {
+                if (j % 10 == 0)
+                {
+                    kill(getpid(), 0);
+                }
+                else
+                {
+                    getppid();
+                }
+            }
+            return 0;
+        }
+    }
+    reap_all();
+    return 0;
+}
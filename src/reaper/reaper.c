@@ -7,6 +7,11 @@
 #include <sys/prctl.h>
 #include <sys/wait.h>
 
+#include "reaper.h"
+
+/* The most records that we'll send to the tracer in one write. */
+#define MAX_BATCH 64
+
 void error(const char* msg) 
 {
     if (errno == EPIPE) 
@@ -19,6 +24,56 @@ void error(const char* msg)
     /* NOTREACHED */
 }
 
+/* Gets the time that the process started at (in clock ticks since boot) from
+ * /proc/<pid>/stat. The tracer uses this to tell whether we're talking about
+ * the process that it thinks we are (in case the PID got recycled). Returns 0
+ * if we couldn't get it. */
+uint64_t get_start_time(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+
+    // It looks like "<pid> (<name>) <state> ...", but the name could contain
+    // brackets and spaces, so we look for the last closing bracket. Then we
+    // are at field 3 (the state), and we want field 22.
+    char* field = strrchr(buf, ')');
+    for (int i = 2; i < 22 && field; ++i)
+    {
+        field = strchr(field + 1, ' ');
+    }
+    return field ? strtoull(field + 1, NULL, 10) : 0;
+}
+
+/* Writes the whole buffer to stdout (the pipe to the tracer). */
+void send(const void* data, size_t len)
+{
+    const char* ptr = data;
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, ptr, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            error("writing records");
+            return;
+        }
+        ptr += n;
+        len -= n;
+    }
+}
+
 int main(int argc, char** argv) 
 {
     if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) 
@@ -29,21 +84,45 @@ int main(int argc, char** argv)
     struct sigaction sa = {.sa_handler = SIG_IGN};
     sigaction(SIGPIPE, &sa, 0);
 
-    pid_t pid;
-    while ((pid = wait(NULL)) != -1) 
+    struct reaper_record batch[MAX_BATCH];
+    for (;;)
     {
-        // Shove the pid directly down the pipe binary style. Bit weird to use
-        // binary data with stdout but eh shrug. The tracer doesn't need to be
-        // told the ending status since they'd already know that.
-        errno = 0;
-        if (fwrite(&pid, sizeof(pid), 1, stdout) != 1) 
+        // Block until we reap something, then reap everything else that's
+        // ready as well, so that an orphan storm turns into a few big writes
+        // instead of one write for each orphan.
+        size_t count = 0;
+        int flags = 0;
+        while (count < MAX_BATCH)
         {
-            error("writing pid");
+            // Peek at it first (WNOWAIT), since we need its start time, and
+            // that's gone once we reap it.
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT | flags) == -1
+                || info.si_pid == 0)
+            {
+                break;
+            }
+            pid_t pid = info.si_pid;
+
+            struct reaper_record* record = &batch[count];
+            memset(record, 0, sizeof(*record));
+            record->startTime = get_start_time(pid);
+            if (wait4(pid, &record->status, 0, &record->rusage) == -1)
+            {
+                error("wait4");
+            }
+            record->version = REAPER_RECORD_VERSION;
+            record->pid = pid;
+            clock_gettime(CLOCK_MONOTONIC, &record->time);
+            count++;
+            flags = WNOHANG;
         }
-        if (fflush(stdout) != 0) 
+        if (count == 0)
         {
-            error("flushing");
+            break;
         }
+        send(batch, count * sizeof(batch[0]));
     }
 
     if (errno != ECHILD) 
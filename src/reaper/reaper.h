@@ -0,0 +1,34 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  reaper
+ *
+ *      What the reaper sends down the pipe to the tracer. This gets included
+ *      by both the reaper (C) and the tracer (C++), so keep it plain C.
+ */
+#ifndef FORKTRACE_REAPER_H
+#define FORKTRACE_REAPER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* Bump this whenever struct reaper_record changes, so that the tracer notices
+ * if it's talking to an old reaper (e.g., one that it found in the $PATH)
+ * instead of misreading everything that it sends. */
+#define REAPER_RECORD_VERSION 2
+
+/* The reaper sends one of these for each orphan that it reaps. It sends them
+ * in batches (as many as it could reap without blocking), so a single read on
+ * the tracer's end will usually get several of them. */
+struct reaper_record
+{
+    uint32_t version;       /* always REAPER_RECORD_VERSION */
+    int32_t pid;            /* the orphan that was reaped */
+    int32_t status;         /* its wait status */
+    int32_t reserved;       /* always zero (keeps the rest 8-byte aligned) */
+    uint64_t startTime;     /* from /proc/<pid>/stat, or 0 if we couldn't */
+    struct timespec time;   /* when it was reaped (CLOCK_MONOTONIC) */
+    struct rusage rusage;   /* its resource usage (from wait4) */
+};
+
+#endif /* FORKTRACE_REAPER_H */
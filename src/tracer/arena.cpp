@@ -0,0 +1,41 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  arena
+ *
+ *      See arena.hpp. The blocks start small and double in size, since most
+ *      processes only ever have a few events in them.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "arena.hpp"
+
+using std::string_view;
+
+/* The biggest block that we'll allocate (unless someone asks for more than
+ * this in one go). Blocks double in size until they get here, so that a
+ * process with only a handful of events doesn't hold onto much. */
+constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+/* Starts a new block that has room for the allocation and hands out memory
+ * from it. Whatever was left in the old block is wasted. */
+void* Arena::_grow(size_t size, size_t align)
+{
+    size_t blockSize = std::max(_blockSize, size + align);
+    _blocks.emplace_back(new char[blockSize]); // no need to zero it
+    _next = _blocks.back().get();
+    _left = blockSize;
+    _blockSize = std::min(_blockSize * 2, MAX_BLOCK_SIZE);
+    return allocate(size, align);
+}
+
+string_view Arena::copy(string_view str)
+{
+    if (str.empty())
+    {
+        return string_view();
+    }
+    char* chars = static_cast<char*>(allocate(str.size(), 1));
+    memcpy(chars, str.data(), str.size());
+    return string_view(chars, str.size());
+}
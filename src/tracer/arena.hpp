@@ -0,0 +1,63 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  arena
+ *
+ *      A bump allocator for things that are only ever freed all at once, like
+ *      the events of a process. Allocating out of here costs a pointer bump
+ *      instead of a trip to malloc (and its 16 bytes of bookkeeping), and
+ *      keeps the events of a process next to each other in memory.
+ */
+#ifndef FORKTRACE_ARENA_HPP
+#define FORKTRACE_ARENA_HPP
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <vector>
+
+class Arena
+{
+private:
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    char* _next; // where the next allocation goes in the current block
+    size_t _left; // bytes left in the current block
+    size_t _blockSize; // size of the next block that we'll allocate
+
+    void* _grow(size_t size, size_t align);
+
+public:
+    Arena() : _next(nullptr), _left(0), _blockSize(128) { }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /* Returns `size` bytes of memory aligned to `align` (which must be a power
+     * of two). The memory lives until the arena is destroyed. */
+    void* allocate(size_t size, size_t align)
+    {
+        size_t pad = -reinterpret_cast<uintptr_t>(_next) & (align - 1);
+        if (pad + size > _left)
+        {
+            return _grow(size, align);
+        }
+        void* ptr = _next + pad;
+        _next += pad + size;
+        _left -= pad + size;
+        return ptr;
+    }
+
+    /* Constructs a T inside the arena. The arena never runs any destructors,
+     * so whoever owns the object has to do that if T needs it. */
+    template<typename T, typename ...Args>
+    T* make(Args&&... args)
+    {
+        void* ptr = allocate(sizeof(T), alignof(T));
+        return new (ptr) T(std::forward<Args>(args)...);
+    }
+
+    /* Copies the characters of the string into the arena. */
+    std::string_view copy(std::string_view str);
+};
+
+#endif /* FORKTRACE_ARENA_HPP */
@@ -0,0 +1,129 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  argv
+ *
+ *      See argv.hpp. The interned lists live in one table that's shared by
+ *      every thread, and each list takes itself out of the table when the
+ *      last Argv that refers to it goes away.
+ */
+#include <mutex>
+#include <unordered_map>
+
+#include "argv.hpp"
+#include "util.hpp"
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::weak_ptr;
+
+struct Argv::Data
+{
+    vector<string> args;
+    string joined;
+    size_t hash;
+};
+
+/* Every list of arguments that's currently alive, by hash. We keep the raw
+ * pointer next to the weak_ptr, since the weak_ptr can't give us that anymore
+ * once the Data is on its way out (see release below). */
+struct ArgvTable
+{
+    std::mutex lock;
+    std::unordered_multimap<size_t, std::pair<const Argv::Data*,
+                                              weak_ptr<const Argv::Data>>> map;
+};
+
+/* Never destroyed, since Argvs could still be around when static destructors
+ * run (and they need the table when they go). */
+static ArgvTable& table()
+{
+    static ArgvTable* table = new ArgvTable;
+    return *table;
+}
+
+static size_t hash_args(const vector<string>& args)
+{
+    size_t hash = args.size();
+    for (const string& arg : args)
+    {
+        hash = hash * 31 + std::hash<string>()(arg);
+    }
+    return hash;
+}
+
+/* The deleter for interned Data. Takes it out of the table first, so that
+ * nobody can find it after it's been freed. Anyone who finds it in between
+ * the last reference going away and us getting the lock will fail to lock the
+ * weak_ptr, so they'll intern a new copy instead. */
+static void release(const Argv::Data* data)
+{
+    {
+        ArgvTable& t = table();
+        std::scoped_lock<std::mutex> guard(t.lock);
+        auto [begin, end] = t.map.equal_range(data->hash);
+        for (auto it = begin; it != end; ++it)
+        {
+            if (it->second.first == data)
+            {
+                t.map.erase(it);
+                break;
+            }
+        }
+    }
+    delete data;
+}
+
+/* The empty list isn't in the table, and it's never freed. */
+static const shared_ptr<const Argv::Data>& empty_data()
+{
+    static auto* data = new shared_ptr<const Argv::Data>(
+        new Argv::Data{{}, "", hash_args({})}, [](auto) { });
+    return *data;
+}
+
+Argv::Argv() : _data(empty_data()) { }
+
+Argv::Argv(vector<string> args)
+{
+    if (args.empty())
+    {
+        _data = empty_data();
+        return;
+    }
+    size_t hash = hash_args(args);
+    ArgvTable& t = table();
+    std::scoped_lock<std::mutex> guard(t.lock);
+    auto [begin, end] = t.map.equal_range(hash);
+    for (auto it = begin; it != end; ++it)
+    {
+        // It's safe to look through the raw pointer while we have the lock,
+        // since release needs the lock before it can free anything.
+        if (it->second.first->args == args)
+        {
+            if ((_data = it->second.second.lock()))
+            {
+                return;
+            }
+        }
+    }
+    string joined = join(args);
+    auto data = new Data{std::move(args), std::move(joined), hash};
+    _data = shared_ptr<const Data>(data, release);
+    t.map.emplace(hash, std::make_pair(data, weak_ptr<const Data>(_data)));
+}
+
+const vector<string>& Argv::args() const
+{
+    return _data->args;
+}
+
+const string& Argv::joined() const
+{
+    return _data->joined;
+}
+
+size_t Argv::hash() const
+{
+    return _data->hash;
+}
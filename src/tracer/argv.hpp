@@ -0,0 +1,47 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  argv
+ *
+ *      Program arguments that are interned, so that every process with the
+ *      same arguments shares the one (immutable) copy of them. A make that
+ *      forks off thousands of `sh -c ...` children only stores each distinct
+ *      command line once, and comparing two of them is a pointer comparison.
+ */
+#ifndef FORKTRACE_ARGV_HPP
+#define FORKTRACE_ARGV_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Argv
+{
+public:
+    struct Data; // defined in the source file
+
+private:
+    std::shared_ptr<const Data> _data;
+
+public:
+    /* An empty list of arguments. */
+    Argv();
+
+    /* Interns the arguments. If an identical list of arguments is already out
+     * there, then we'll end up sharing it. Thread-safe. */
+    explicit Argv(std::vector<std::string> args);
+
+    const std::vector<std::string>& args() const;
+
+    /* The arguments joined together with spaces (see join in util.hpp). This
+     * is worked out once when the arguments are interned. */
+    const std::string& joined() const;
+
+    size_t hash() const;
+
+    /* Since they're interned, two lists of arguments are equal if and only if
+     * they are the same object. */
+    bool operator==(const Argv& other) const { return _data == other._data; }
+    bool operator!=(const Argv& other) const { return _data != other._data; }
+};
+
+#endif /* FORKTRACE_ARGV_HPP */
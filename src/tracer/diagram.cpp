@@ -4,6 +4,7 @@
  *
  *      TODO
  */
+#include <algorithm>
 #include <cassert>
 #include <fmt/core.h>
 
@@ -99,8 +100,9 @@ void Diagram::Node::print(Indent indent) const
     }
 }
 
-Diagram::Path::Path(int startLine) 
-    : startLine(startLine), endLine(-1), lane(-1), killPartner(nullptr) 
+Diagram::Path::Path(const Process& process, int startLine) 
+    : process(&process), startLine(startLine), endLine(-1), lane(-1), 
+    next(-1), killPartner(nullptr) 
 {
     assert(startLine >= 0);
 }
@@ -200,58 +202,22 @@ void Drawer::draw_string(Colour c, string_view str)
  * for that path (see above). */
 int Diagram::_get_next_event(const Process& process, size_t start) 
 {
-    for (size_t i = start; i < process.event_count(); ++i) 
+    int i = process.next_visible_event(start, _hidden);
+    if (i == -1)
     {
-        const Event& event = process.event(i);
-
-        if ((_options & SHOW_EXECS) == 0) 
-        {
-            if (dynamic_cast<const ExecEvent*>(&event)) 
-            {
-                continue;
-            }
-        }
-        if ((_options & SHOW_FAILED_EXECS) == 0) 
-        {
-            auto exec = dynamic_cast<const ExecEvent*>(&event);
-            if (exec && !exec->succeeded()) 
-            {
-                continue;
-            }
-        }
-        if ((_options & SHOW_NON_FATAL_SIGNALS) == 0) 
-        {
-            auto signal = dynamic_cast<const SignalEvent*>(&event);
-            if (signal && !signal->killed) 
-            {
-                continue;
-            }
-        }
-        if ((_options & SHOW_SIGNAL_SENDS) == 0) 
-        {
-            if (dynamic_cast<const KillEvent*>(&event)) 
-            {
-                continue;
-            }
-            if (dynamic_cast<const RaiseEvent*>(&event)) 
-            {
-                continue;
-            }
-        }
-
-        // Okay, we've found an event. If it's a KillEvent, then we'll signal
-        // that it's in our path so that our partner knows about it.
-        if (auto killEvent = dynamic_cast<const KillEvent*>(&event)) 
-        {
-            auto path = _paths.find(&process);
-            assert(path != _paths.end());
-            assert(!path->second.killPartner);
-            path->second.killPartner = &killEvent->linked_path();
-        }
+        return -1;
+    }
 
-        return i;
+    // Okay, we've found an event. If it's a KillEvent, then we'll signal
+    // that it's in our path so that our partner knows about it.
+    if (auto killEvent = event_cast<KillEvent>(&process.event(i))) 
+    {
+        auto path = _paths.find(&process);
+        assert(path != _paths.end());
+        assert(!path->second.killPartner);
+        path->second.killPartner = &killEvent->linked_path();
     }
-    return -1;
+    return i;
 }
 
 /* Helper functions to create nodes. startPath returns the first node in
@@ -275,9 +241,12 @@ Diagram::Node Diagram::_continue_path(const Diagram::Node& prev)
     return Node(prev.process, nullptr, prev.next);
 }
 
-Diagram::Node Diagram::_start_path(const Process& process) 
+Diagram::Node Diagram::_start_path(const Process& process, int lineNum) 
 {
-    return Node(process, nullptr, _get_next_event(process, 0));
+    assert(_paths.find(&process) == _paths.end());
+    Path& path = _paths[&process] = Path(process, lineNum);
+    path.next = _get_next_event(process, 0);
+    return Node(process, nullptr, path.next);
 }
 
 /* Uses a recursive algorithm to allocate all of the processes in the tree
@@ -289,7 +258,7 @@ Diagram::Node Diagram::_start_path(const Process& process)
 // TODO really sus to have pointers into a C++ container (it relies on the
 // container not being modified during the lifetime of the pointers). I'll
 // restructure this at some point I think.
-void Diagram::_allocate_process_to_lane(vector<vector<Path*>>& lanes, 
+void Diagram::_allocate_process_to_lane(vector<vector<const Path*>>& lanes, 
                                        const Process& process)
 {
     assert(_paths.find(&process) != _paths.end());
@@ -339,19 +308,16 @@ void Diagram::_allocate_process_to_lane(vector<vector<Path*>>& lanes,
 
     // Now plonk down each of the children. We have to iterate backwards to
     // get the correct behaviour so that we can avoid overlapping lines.
-    for (long i = process.event_count() - 1; i >= 0; --i) 
+    const vector<ProcessId>& children = process.children();
+    for (auto it = children.rbegin(); it != children.rend(); ++it) 
     {
-        const Event* e = &process.event(i);
-        if (auto forkEvent = dynamic_cast<const ForkEvent*>(e)) 
-        {
-            _allocate_process_to_lane(lanes, *forkEvent->child.get());
-        }
+        _allocate_process_to_lane(lanes, process.tree().get(*it));
     }
 }
 
 /* Checks if the path for this process is ready to terminate on this line
  * (based on what happened on the previous line). */
-bool Diagram::_path_ready_to_end(const vector<Node>& prevLine, 
+bool Diagram::_path_ready_to_end(const Line& prevLine, 
                                 const Process& process) const
 {
     for (const Node& node : prevLine) 
@@ -371,27 +337,24 @@ bool Diagram::_path_ready_to_end(const vector<Node>& prevLine,
  * path that the linking line for the LinkEvent ends on (a ForkEvent will
  * return null since the process of the child path does not exist in the
  * previous line). */
-const Process* Diagram::_do_link_event(vector<Node>& curLine, 
+const Process* Diagram::_do_link_event(const Line& prevLine,
+                                      Line& curLine, 
                                       int lineNum, 
                                       Path& path, 
                                       const Node& prevNode, 
                                       const LinkEvent& event) 
 {
-    const vector<Node>& prevLine = _lines.back();
     const Process& other = event.linked_path();
 
-    if (dynamic_cast<const ForkEvent*>(&event)) 
+    if (is_event<ForkEvent>(event)) 
     {
         // This event will generate a new path
-        assert(_paths.find(&other) == _paths.end());
-        _paths[&other] = Path(lineNum);
-        assert(_paths.find(&other) != _paths.end());
         curLine.push_back(_get_successor(prevNode));
-        curLine.push_back(_start_path(other));
+        curLine.push_back(_start_path(other, lineNum));
         return nullptr;
     }
 
-    if (dynamic_cast<const ReapEvent*>(&event)) 
+    if (is_event<ReapEvent>(event)) 
     {
         // This event will remove an existing path from this line
         assert(_paths.find(&other) != _paths.end());
@@ -405,7 +368,7 @@ const Process* Diagram::_do_link_event(vector<Node>& curLine,
         return &other;
     }
 
-    if (dynamic_cast<const KillEvent*>(&event)) 
+    if (is_event<KillEvent>(event)) 
     {
         auto partner = _paths.find(&other);
         if (partner == _paths.end()) 
@@ -440,14 +403,14 @@ const Process* Diagram::_do_link_event(vector<Node>& curLine,
     assert(!"Unreachable");
 }
 
-/* Generates the next line of the diagram. Uses all of the lines so far 
- * (in `_lines`) to help figure this out. Will return false if there are
- * no lines left to build, and appends to `_lines` otherwise. */
-bool Diagram::_build_next_line() 
+/* Generates the next line of the diagram from the previous one (`line`). Will
+ * return false if there are no lines left to build. Otherwise, `line` gets
+ * replaced with the new line, and its events are added to their paths. */
+bool Diagram::_build_next_line(Line& line) 
 {
-    assert(_lines.size() > 0);
-    vector<Node> curLine;
-    int lineNum = _lines.size();
+    assert(_lineCount > 0);
+    Line curLine;
+    int lineNum = _lineCount;
 
     // There are horizontal lines drawn across the fork diagram between lanes
     // (for descendants of LinkEvent) to indicate forking/reaping/etc. We have
@@ -461,7 +424,7 @@ bool Diagram::_build_next_line()
     // previous line wants to fork, then do that. If a process from the last
     // line wants to reap another process, then wait until that process is
     // finished, and then arrange for that to happen.
-    for (const Node& prevNode : _lines.back()) 
+    for (const Node& prevNode : line) 
     {
         const Event* const event = prevNode.next_event(); 
         assert(_paths.find(&prevNode.process) != _paths.end());
@@ -494,7 +457,7 @@ bool Diagram::_build_next_line()
             continue; // Otherwise, let the process die
         }
 
-        if (auto link = dynamic_cast<const LinkEvent*>(event)) 
+        if (auto link = event_cast<LinkEvent>(event)) 
         {
             if (eventEnd) 
             {
@@ -504,7 +467,8 @@ bool Diagram::_build_next_line()
                 curLine.push_back(_continue_path(prevNode));
                 continue;
             }
-            eventEnd = _do_link_event(curLine, lineNum, path, prevNode, *link);
+            eventEnd = _do_link_event(line, curLine, lineNum, path, 
+                prevNode, *link);
             continue;
         }
         curLine.push_back(_get_successor(prevNode));
@@ -514,12 +478,65 @@ bool Diagram::_build_next_line()
     {
         return false;
     }
-    _lines.push_back(move(curLine));
+
+    // Only the nodes with events need to be remembered. The continuations in
+    // between can be worked out again from these (see _expand_line).
+    for (const Node& node : curLine)
+    {
+        if (node.event)
+        {
+            _paths[&node.process].steps.push_back(
+                Step { lineNum, node.next, node.event });
+        }
+    }
+    line = std::move(curLine);
+    _lineCount++;
     return true;
 }
 
+/* Works out the Nodes on the specified line from the paths that cover it and
+ * their Steps. The lines have to be expanded in order starting from 0, with
+ * the same `cursors` each time (which should be empty to begin with). */
+void Diagram::_expand_line(size_t lineNum, 
+                           vector<Cursor>& cursors, 
+                           Line& line) const
+{
+    line.clear();
+    cursors.resize(_lanes.size(), Cursor { 0, 0 });
+    for (size_t lane = 0; lane < _lanes.size(); ++lane) 
+    {
+        const vector<const Path*>& paths = _lanes[lane];
+        Cursor& cursor = cursors[lane];
+        while (cursor.path < paths.size() 
+            && (size_t)paths[cursor.path]->endLine < lineNum) 
+        {
+            cursor.path++;
+            cursor.step = 0;
+        }
+        if (cursor.path == paths.size() 
+            || (size_t)paths[cursor.path]->startLine > lineNum) 
+        {
+            continue; // Nothing in this lane on this line
+        }
+
+        const Path& path = *paths[cursor.path];
+        if (cursor.step < path.steps.size() 
+            && (size_t)path.steps[cursor.step].line == lineNum) 
+        {
+            const Step& step = path.steps[cursor.step++];
+            line.emplace_back(*path.process, step.event, step.next);
+        }
+        else 
+        {
+            int next = cursor.step == 0 
+                ? path.next : path.steps[cursor.step - 1].next;
+            line.emplace_back(*path.process, nullptr, next);
+        }
+    }
+}
+
 /* Draw a single line of the diagram. `lineNum` is indexed from 0. */
-void Diagram::_draw_line(const vector<Node>& line, size_t lineNum) 
+void Diagram::_draw_line(const Line& line, size_t lineNum) 
 {
     _renderer->start_line(lineNum);
     // If we're currently in the middle of drawing a dashed line to another
@@ -571,14 +588,14 @@ void Diagram::_draw_line(const vector<Node>& line, size_t lineNum)
         } 
         else if (node.event) 
         {
-            if (auto linkEv = dynamic_cast<const LinkEvent*>(node.event)) 
+            if (auto linkEv = event_cast<LinkEvent>(node.event)) 
             {
                 // This is the start of a dashed line across lanes.
                 assert(!curEvent);
                 curEvent = linkEv;
                 // If this is a kill event, the 'dashed line' could possibly
                 // be going backwards, in which case we'll draw it in reverse.
-                if (auto killEv = dynamic_cast<const KillEvent*>(linkEv)) 
+                if (auto killEv = event_cast<KillEvent>(linkEv)) 
                 {
                     reversed = !killEv->sender;
                 }
@@ -620,15 +637,34 @@ void Diagram::_draw_line(const vector<Node>& line, size_t lineNum)
  * built and all of the lanes have been allocated. */
 void Diagram::_draw() 
 {
-    for (size_t i = 0; i < _lines.size(); ++i) 
+    vector<Cursor> cursors;
+    Line line;
+    for (size_t i = 0; i < _lineCount; ++i) 
     {
-        _draw_line(_lines.at(i), i);
+        _expand_line(i, cursors, line);
+        _draw_line(line, i);
     }
 }
 
 Diagram::Diagram(const Process& leader, size_t laneWidth, int opts) 
-    : _leader(leader), _options(opts)
+    : _leader(leader), _options(opts), _hidden(0)
 {
+    if ((_options & SHOW_EXECS) == 0)
+    {
+        _hidden |= Event::EXEC;
+    }
+    if ((_options & SHOW_FAILED_EXECS) == 0)
+    {
+        _hidden |= Event::FAILED_EXEC;
+    }
+    if ((_options & SHOW_NON_FATAL_SIGNALS) == 0)
+    {
+        _hidden |= Event::NON_FATAL_SIGNAL;
+    }
+    if ((_options & SHOW_SIGNAL_SENDS) == 0)
+    {
+        _hidden |= Event::SIGNAL_SEND;
+    }
     _renderer = std::make_unique<Drawer>(laneWidth);
     redraw();
 }
@@ -646,19 +682,25 @@ const Window& Diagram::result() const
 void Diagram::redraw()
 {
     _paths.clear();
-    _lines.clear();
-    _paths[&_leader] = Path(0);
-    _lines.push_back({ _start_path(_leader) });
+    _lanes.clear();
+    Line line { _start_path(_leader, 0) };
+    _lineCount = 1;
     
     // Figure out what nodes go in each line of the diagram
-    while (_build_next_line()) { } 
+    while (_build_next_line(line)) { } 
 
     // Recursively allocates all the paths to a lane
-    vector<vector<Path*>> lanes { vector<Path*>() };
-    _allocate_process_to_lane(lanes, _leader);
+    _lanes.emplace_back();
+    _allocate_process_to_lane(_lanes, _leader);
+    for (auto& lane : _lanes) 
+    {
+        std::sort(lane.begin(), lane.end(), [](const Path* a, const Path* b) 
+        {
+            return a->startLine < b->startLine;
+        });
+    }
 
-    _renderer->start(lanes.size(), _lines.size());
-    _laneCount = lanes.size();
+    _renderer->start(_lanes.size(), _lineCount);
     _draw(); 
 }
 
@@ -673,33 +715,59 @@ const Event* Diagram::find(size_t lane,
                            const Process*& process, 
                            int& eventIndex) const
 {
-    if (line >= _lines.size()) 
+    if (line >= _lineCount) 
     {
         return nullptr;
     }
-    for (const Node& node : _lines.at(line)) 
+    process = nullptr;
+    if (lane >= _lanes.size()) 
     {
-        auto it = _paths.find(&node.process);
-        assert(it != _paths.end());
-        assert(it->second.lane >= 0);
-        if ((size_t)it->second.lane == lane) 
+        return nullptr;
+    }
+
+    // Find the last path in the lane to start on or before the line.
+    const vector<const Path*>& paths = _lanes.at(lane);
+    auto pathIt = std::upper_bound(paths.begin(), paths.end(), line,
+        [](size_t line, const Path* path) 
         {
-            if (node.next == -1) 
-            {
-                // Will go to -1 if there are no events (this is desired)
-                eventIndex = (int)node.process.event_count() - 1;
-            } 
-            else 
-            {
-                // Will go to -1 if node.next is event 0 (this is desired)
-                eventIndex = node.next - 1;
-            }
-            process = &node.process;
-            return node.event;
+            return line < (size_t)path->startLine;
+        });
+    if (pathIt == paths.begin() || (size_t)(*--pathIt)->endLine < line) 
+    {
+        return nullptr;
+    }
+    const Path& path = **pathIt;
+
+    // Then the last step along it that's on or before the line.
+    auto stepIt = std::upper_bound(path.steps.begin(), path.steps.end(), line,
+        [](size_t line, const Step& step) 
+        {
+            return line < (size_t)step.line;
+        });
+    const Event* event = nullptr;
+    int next = path.next;
+    if (stepIt != path.steps.begin()) 
+    {
+        --stepIt;
+        next = stepIt->next;
+        if ((size_t)stepIt->line == line) 
+        {
+            event = stepIt->event;
         }
     }
-    process = nullptr;
-    return nullptr;
+
+    if (next == -1) 
+    {
+        // Will go to -1 if there are no events (this is desired)
+        eventIndex = (int)path.process->event_count() - 1;
+    } 
+    else 
+    {
+        // Will go to -1 if next is event 0 (this is desired)
+        eventIndex = next - 1;
+    }
+    process = path.process;
+    return event;
 }
 
 void Diagram::get_coords(size_t lane, size_t line, size_t& x, size_t& y) const
@@ -718,10 +786,13 @@ size_t Diagram::locate(const Process& process) const
 void Diagram::print() const 
 {
     std::cerr << "LINES\n";
-    for (size_t i = 0; i < _lines.size(); ++i) 
+    vector<Cursor> cursors;
+    Line line;
+    for (size_t i = 0; i < _lineCount; ++i) 
     {
         std::cerr << format("{}Line {}\n", Indent(1), i);
-        for (const Node& node : _lines.at(i)) 
+        _expand_line(i, cursors, line);
+        for (const Node& node : line) 
         {
             auto pair = _paths.find(&node.process);
             assert(pair != _paths.end());
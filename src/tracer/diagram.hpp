@@ -36,12 +36,28 @@ public:
         SHOW_EXECS | MERGE_EXECS | SHOW_SIGNAL_SENDS;
 
 private:
-    /* Represents the location of a Process as viewed on the diagram. */
+    /* An event on a path, i.e., a point where the path has something other
+     * than a plain continuation on the diagram. `next` is the index of the
+     * event that the path is waiting on after this one (see Node). */
+    struct Step
+    {
+        int line;
+        int next;
+        const Event* event;
+    };
+
+    /* Represents the location of a Process as viewed on the diagram. The path
+     * covers every line from startLine to endLine (inclusive), and only the
+     * lines that have an event on them get a Step. Everything in between is
+     * a continuation, which we work out from the Steps when it's needed. */
     struct Path 
     {
+        const Process* process;
         int startLine;
         int endLine; // -1 if not sure yet
         int lane; // -1 if not sure yet
+        int next; // index of the first pending event, or -1 if none
+        std::vector<Step> steps; // in order of line
 
         /* We use this to help sync up the paths of processes when we are
          * trying to link them up for a kill event. When a path has a pending
@@ -49,13 +65,24 @@ private:
          * event so that the other path knows they're ready to dance ;-) */
         const Process* killPartner;
 
-        Path(int startLine);
-        Path() : startLine(-1), endLine(-1), lane(-1), killPartner(nullptr) { }
+        Path(const Process& process, int startLine);
+        Path() : process(nullptr), startLine(-1), endLine(-1), lane(-1), 
+            next(-1), killPartner(nullptr) { }
+    };
+
+    /* Where a lane is up to when going through the diagram line by line (see
+     * _expand_line). `path` indexes into the lane and `step` into its path. */
+    struct Cursor
+    {
+        size_t path;
+        size_t step;
     };
 
     /* This class represents a point in a process's lifecycle which occurs on
      * a particular line of the diagram. Each line contains a bunch of lanes, 
-     * which are occupied by these Nodes. */
+     * which are occupied by these Nodes. We only hold on to one line of them
+     * at a time (while building or drawing), since the Paths are enough to
+     * work out the rest. */
     struct Node 
     {
         const Process& process;
@@ -71,12 +98,18 @@ private:
         void print(Indent indent = 0) const;
     };
 
+    /* The Nodes in a line are organized so that their lane numbers are in
+     * ascending order (however the index isn't necessarily equal to the lane
+     * number, since there may be jumps). */
+    using Line = std::vector<Node>;
+
     /* The _renderer is a pointer just so that we don't have to define the
      * Drawer class in this header file (to avoid an incomplete type). */
     const Process& _leader; // the root of the process tree
     std::unique_ptr<Drawer> _renderer; // the object that renders the diagram
-    size_t _laneCount;  // index of rightmost lane + 1
+    size_t _lineCount; // number of lines in the diagram
     int _options; // rendering config (TODO why no implicit int? compiler bug?)
+    uint8_t _hidden; // Event::Visibility flags that _options hides
 
     /* Stores the location/information about the path occupied by each process
      * on the diagram. I could store that information inside the Process class
@@ -84,27 +117,26 @@ private:
      * structures (and doing that has caused problems for me in the past). */
     std::unordered_map<const Process*, Path> _paths;
 
-    /* The Nodes in this vector are organized so that their lane numbers are
-     * in ascending order (however the index isn't necessarily equal to the
-     * lane number, since there may be jumps).
-     *
-     * TODO make sure to be careful with having references to Nodes from this 
-     * vector (they'll be invalidated if vector resized etc.). */
-    std::vector<std::vector<Node>> _lines;
+    /* The paths in each lane, in order of their starting line. The pointers
+     * point into _paths (which doesn't move its values around). */
+    std::vector<std::vector<const Path*>> _lanes;
 
     /* Private functions, see source file. */
     int _get_next_event(const Process& process, size_t start);
     Node _get_successor(const Node& prevNode);
     Node _continue_path(const Node& prevNode);
-    Node _start_path(const Process& process);
-    void _allocate_process_to_lane(std::vector<std::vector<Path*>>& lanes, 
+    Node _start_path(const Process& process, int lineNum);
+    void _allocate_process_to_lane(std::vector<std::vector<const Path*>>& lanes,
             const Process& process);
-    bool _path_ready_to_end(const std::vector<Node>& prevLine,
+    bool _path_ready_to_end(const Line& prevLine,
             const Process& process) const;
-    const Process* _do_link_event(std::vector<Node>& curLine, int lineNum, 
-            Path& path, const Node& prevNode, const LinkEvent& event);
-    bool _build_next_line();
-    void _draw_line(const std::vector<Node>& line, size_t lineNum);
+    const Process* _do_link_event(const Line& prevLine, Line& curLine, 
+            int lineNum, Path& path, const Node& prevNode, 
+            const LinkEvent& event);
+    bool _build_next_line(Line& line);
+    void _expand_line(size_t lineNum, std::vector<Cursor>& cursors, 
+            Line& line) const;
+    void _draw_line(const Line& line, size_t lineNum);
     void _draw();
 
 public:
@@ -150,8 +182,8 @@ public:
     size_t locate(const Process& process) const;
 
     /* Get the number of lanes/lines on the diagram. */
-    size_t line_count() const { return _lines.size(); }
-    size_t lane_count() const { return _laneCount; }
+    size_t line_count() const { return _lineCount; }
+    size_t lane_count() const { return _lanes.size(); }
 
     /* Get the leader process of this diagram. */
     const Process& leader() const { return _leader; }
@@ -1,5 +1,8 @@
 #include <cassert>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 
 #include "event.hpp"
 #include "process.hpp"
@@ -9,19 +12,45 @@
 using std::string;
 using std::string_view;
 using std::vector;
-using std::unique_ptr;
-using std::shared_ptr;
 using fmt::format;
 
+/* The side table for source locations (see intern_location). It's a deque so
+ * that references to the locations stay valid as it grows. Location ids start
+ * at 1 (so that 0 can be NO_LOCATION), so id N is at index N - 1. */
+static std::mutex gLocationLock;
+static std::deque<SourceLocation> gLocations;
+static std::unordered_map<string, LocationId> gLocationIds;
+
 string SourceLocation::to_string() const 
 {
     return format("{}:{}:{}", file, func, line);
 }
 
+LocationId intern_location(SourceLocation location)
+{
+    string key = location.file + '\0' + location.func + '\0' 
+        + std::to_string(location.line);
+    std::scoped_lock<std::mutex> guard(gLocationLock);
+    auto [it, added] = gLocationIds.emplace(std::move(key), 0);
+    if (added)
+    {
+        gLocations.push_back(std::move(location));
+        it->second = gLocations.size();
+    }
+    return it->second;
+}
+
+const SourceLocation& get_location(LocationId id)
+{
+    assert(id != NO_LOCATION);
+    std::scoped_lock<std::mutex> guard(gLocationLock);
+    return gLocations.at(id - 1);
+}
+
 string ExecEvent::file() const 
 {
     assert(!calls.empty());
-    return calls.back().file;
+    return string(calls.back().file);
 }
 
 bool ExecEvent::succeeded() const 
@@ -30,20 +59,52 @@ bool ExecEvent::succeeded() const
     return calls.back().errcode == 0;
 }
 
+void Event::classify()
+{
+    visibility = 0;
+    switch (kind)
+    {
+        case EventKind::EXEC:
+            visibility |= EXEC;
+            if (!static_cast<const ExecEvent*>(this)->succeeded())
+            {
+                visibility |= FAILED_EXEC;
+            }
+            break;
+        case EventKind::SIGNAL:
+            if (!static_cast<const SignalEvent*>(this)->killed)
+            {
+                visibility |= NON_FATAL_SIGNAL;
+            }
+            break;
+        case EventKind::KILL:
+        case EventKind::RAISE:
+            visibility |= SIGNAL_SEND;
+            break;
+        default:
+            break;
+    }
+}
+
 void Event::print_tree(Indent indent) const 
 {
     std::cerr << format("{}{}\n", indent, to_string());
 }
 
+Process& ForkEvent::child() const
+{
+    return owner.tree().get(childId);
+}
+
 string ForkEvent::to_string() const 
 {
-    return format("{} forked {}", owner.pid(), child->pid());
+    return format("{} forked {}", owner.pid(), child().pid());
 }
 
 void ForkEvent::print_tree(Indent indent) const 
 {
     Event::print_tree(indent);
-    child->print_tree(indent + 1);
+    child().print_tree(indent + 1);
 }
 
 void ForkEvent::draw(IEventRenderer& renderer) const 
@@ -109,35 +170,60 @@ void WaitEvent::draw(IEventRenderer& renderer) const
     renderer.draw_char((error == 0) ? Colour::DEFAULT : BAD_WAIT_COLOUR, 'w');
 }
     
-ReapEvent::ReapEvent(Process& owner, 
-                     unique_ptr<WaitEvent> wait, 
-                     shared_ptr<Process> child)
-    : LinkEvent(owner), child(std::move(child)), wait(std::move(wait)) 
+ReapEvent::ReapEvent(Process& owner, WaitEvent* wait, ProcessId child)
+    : LinkEvent(owner, KIND), childId(child), wait(wait) 
 {
     // Now that we are taking the place of the WaitEvent, we need to steal its
-    // SourceLocation for ourselves. (use this-> to prevent shadowing).
-    location = std::move(this->wait->location);
+    // SourceLocation for ourselves.
+    if (wait)
+    {
+        locationId = wait->locationId;
+        wait->locationId = NO_LOCATION;
+    }
+}
+
+ReapEvent::~ReapEvent()
+{
+    // The arena doesn't run destructors (see Arena::make).
+    if (wait)
+    {
+        wait->~WaitEvent();
+    }
+}
+
+Process& ReapEvent::child() const
+{
+    return owner.tree().get(childId);
 }
 
 string ReapEvent::to_string() const 
 {
+    if (!wait)
+    {
+        return format("{} reaped {} {{inferred}}", 
+            owner.pid(), child().death_event().to_string());
+    }
     string target = get_wait_target_string(wait->waitedId);
     if (wait->nohang)
     {
         return format("{} reaped {} {{waited for {} (WNOHANG)}}", 
-            owner.pid(), child->death_event().to_string(), target);
+            owner.pid(), child().death_event().to_string(), target);
     }
     else
     {
         return format("{} reaped {} {{waited for {}}}",
-            owner.pid(), child->death_event().to_string(), target);
+            owner.pid(), child().death_event().to_string(), target);
     }
 }
 
 void ReapEvent::draw(IEventRenderer& renderer) const 
 {
     char c;
-    if (wait->waitedId == -1)
+    if (!wait)
+    {
+        c = 'r';
+    }
+    else if (wait->waitedId == -1)
     {
         c = 'w';
     }
@@ -154,12 +240,12 @@ void ReapEvent::draw(IEventRenderer& renderer) const
 
 char ReapEvent::link_char() const 
 {
-    return child->killed() ? '~' : '-';
+    return child().killed() ? '~' : '-';
 }
 
 Colour ReapEvent::link_colour() const 
 {
-    return child->killed() ? KILLED_COLOUR : EXITED_COLOUR;
+    return child().killed() ? KILLED_COLOUR : EXITED_COLOUR;
 }
 
 string RaiseEvent::to_string() const 
@@ -293,12 +379,33 @@ void ExitEvent::draw(IEventRenderer& renderer) const
     }
 }
 
+string DetachEvent::to_string() const 
+{
+    return format("{} was detached (subtree not traced)", owner.pid());
+}
+
+void DetachEvent::draw(IEventRenderer& renderer) const 
+{
+    renderer.draw_char(DETACHED_COLOUR, '?');
+}
+
+string DowngradeEvent::to_string() const 
+{
+    return format("{} was switched to lifecycle tracing ({} stops/s)", 
+        owner.pid(), rate);
+}
+
+void DowngradeEvent::draw(IEventRenderer& renderer) const 
+{
+    renderer.draw_char(DOWNGRADE_COLOUR, '!');
+}
+
 string ExecCall::to_string(const ExecEvent& event) const 
 {
     if (errcode == 0)
     {
         return format("{} execed {} [ {} ]", 
-            event.owner.pid(), file, join(event.args));
+            event.owner.pid(), file, event.args.joined());
     }
     else
     {
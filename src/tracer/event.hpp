@@ -7,17 +7,24 @@
 #ifndef FORKTRACE_EVENT_HPP
 #define FORKTRACE_EVENT_HPP
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
-#include <optional>
 
+#include "argv.hpp"
 #include "terminal.hpp"
 #include "log.hpp"
 
 class Process; // defined in process.h
 struct ExecEvent; // defined in this file
 
+/* Identifies a Process within its ProcessTree (see process.hpp). */
+using ProcessId = uint32_t;
+constexpr ProcessId NO_PROCESS = UINT32_MAX;
+
 constexpr auto EXITED_COLOUR = Colour::GREEN | Colour::BOLD;
 constexpr auto KILLED_COLOUR = Colour::RED | Colour::BOLD;
 constexpr auto SIGNAL_COLOUR = Colour::YELLOW;
@@ -25,6 +32,8 @@ constexpr auto EXEC_COLOUR = Colour::BLUE | Colour::BOLD;
 constexpr auto BAD_EXEC_COLOUR = Colour::RED;
 constexpr auto BAD_WAIT_COLOUR = Colour::RED;
 constexpr auto SIGNAL_SEND_COLOUR = Colour::MAGENTA;
+constexpr auto DETACHED_COLOUR = Colour::GREY | Colour::BOLD;
+constexpr auto DOWNGRADE_COLOUR = Colour::YELLOW | Colour::BOLD;
 
 /* An interface that Event objects need to draw themselves. The renderer draws
  * the diagram line by line. As the renderer draws a line (from left to right)
@@ -54,14 +63,70 @@ struct SourceLocation
     std::string to_string() const;
 };
 
+/* Source locations live in a side table and events refer to them by id, since
+ * most events don't have one, and the ones that do share a handful of them
+ * (one per call site). NO_LOCATION is the id for "no source location". */
+using LocationId = uint32_t;
+constexpr LocationId NO_LOCATION = 0;
+
+/* Adds the location to the side table (if it isn't there already) and returns
+ * its id. Thread-safe. */
+LocationId intern_location(SourceLocation location);
+
+/* Looks up a location by its id, which mustn't be NO_LOCATION. The reference
+ * stays valid forever (locations are never taken out of the table). */
+const SourceLocation& get_location(LocationId id);
+
+/* Tags each Event with its type, so that we can tell what an event is without
+ * going through RTTI (see event_cast below). */
+enum class EventKind : uint8_t
+{
+    FORK,
+    WAIT,
+    REAP,
+    RAISE,
+    KILL,
+    SIGNAL,
+    EXIT,
+    DETACH,
+    DOWNGRADE,
+    EXEC,
+};
+
+/* Events are allocated out of their owner's Arena (see Process), so they can't
+ * be created or destroyed by anyone else. Keep these small, since there's one
+ * of them for just about everything that a tracee does. */
 struct Event 
 {
+    /* The kinds of event that a diagram can choose to hide (see the options in
+     * Diagram). An event can be in any number of these. */
+    enum Visibility : uint8_t
+    {
+        EXEC                = 1 << 0,
+        FAILED_EXEC         = 1 << 1,
+        NON_FATAL_SIGNAL    = 1 << 2,
+        SIGNAL_SEND         = 1 << 3,
+    };
+
     Process& owner;
-    std::optional<SourceLocation> location;
+    LocationId locationId; // NO_LOCATION if we don't know where it came from
+    const EventKind kind;
+    uint8_t visibility; // Visibility flags, kept up to date by classify()
 
-    Event(Process& owner) : owner(owner) { }
+    Event(Process& owner, EventKind kind) 
+        : owner(owner), locationId(NO_LOCATION), kind(kind), visibility(0) { }
     virtual ~Event() { }
 
+    /* Works out the visibility flags from the rest of the event. This has to
+     * be called again whenever the event changes (Process takes care of it). */
+    void classify();
+
+    /* Returns null if we don't know the source location of this event. */
+    const SourceLocation* location() const 
+    { 
+        return locationId == NO_LOCATION ? nullptr : &get_location(locationId);
+    }
+
     virtual std::string to_string() const = 0;
     virtual void print_tree(Indent indent = 0) const;
     virtual void draw(IEventRenderer& renderer) const = 0; 
@@ -72,7 +137,13 @@ struct Event
  * diagram, or it could represent reaping, or maybe something else? */
 struct LinkEvent : Event 
 {
-    LinkEvent(Process& owner) : Event(owner) { }
+    LinkEvent(Process& owner, EventKind kind) : Event(owner, kind) { }
+
+    static bool has_kind(EventKind kind) 
+    {
+        return kind == EventKind::FORK || kind == EventKind::REAP 
+            || kind == EventKind::KILL;
+    }
 
     virtual const Process& linked_path() const = 0; // return the partner
     virtual char link_char() const = 0; // character used to draw the path
@@ -82,15 +153,19 @@ struct LinkEvent : Event
 /* An event that generates a child who sends SIGCHLD to the parent */
 struct ForkEvent : LinkEvent 
 {
-    std::shared_ptr<Process> child;
+    static constexpr EventKind KIND = EventKind::FORK;
+
+    ProcessId childId; // in the same tree as the owner
+
+    ForkEvent(Process& owner, ProcessId child) 
+        : LinkEvent(owner, KIND), childId(child) { }
 
-    ForkEvent(Process& owner, std::shared_ptr<Process> child) 
-        : LinkEvent(owner), child(std::move(child)) { }
+    Process& child() const;
 
     virtual std::string to_string() const;
     virtual void print_tree(Indent indent) const;
     virtual void draw(IEventRenderer& renderer) const;
-    virtual const Process& linked_path() const { return *child.get(); }
+    virtual const Process& linked_path() const { return child(); }
     virtual char link_char() const { return '-'; }
 };
 
@@ -100,6 +175,8 @@ struct ForkEvent : LinkEvent
  * process's event list and get put inside a ReapEvent instead. */
 struct WaitEvent : Event 
 {
+    static constexpr EventKind KIND = EventKind::WAIT;
+
     pid_t waitedId;
 
     /* This is a bit confusing, but I'd rather not add extra variables since I
@@ -115,11 +192,13 @@ struct WaitEvent : Event
      * stuffed into a ReapEvent if it actually results in a reap. */
     int error;
     bool nohang;
+    pid_t tid; // the thread that's waiting (several of them could be)
 
     /* Initiate a wait that hasn't returned yet. If you find out that the wait
      * failed, you just set ->error to the error status and that's all. */
-    WaitEvent(Process& owner, pid_t waitedId, bool nohang)
-        : Event(owner), waitedId(waitedId), error(0), nohang(nohang) { }
+    WaitEvent(Process& owner, pid_t waitedId, bool nohang, pid_t tid)
+        : Event(owner, KIND), waitedId(waitedId), error(0), nohang(nohang), 
+        tid(tid) { }
 
     virtual std::string to_string() const;
     virtual void draw(IEventRenderer& renderer) const;
@@ -128,16 +207,21 @@ struct WaitEvent : Event
 /* A process is reaped by an ancestor via wait4 or waitid. */
 struct ReapEvent : LinkEvent 
 {
-    std::shared_ptr<Process> child;
-    std::unique_ptr<WaitEvent> wait; // the WaitEvent that triggered this
+    static constexpr EventKind KIND = EventKind::REAP;
+
+    ProcessId childId; // in the same tree as the owner
+    WaitEvent* wait; // the WaitEvent that triggered this (null if we never saw
+                     // the wait call). It's in the same arena as us, and we
+                     // take care of destroying it.
 
-    ReapEvent(Process& owner, 
-              std::unique_ptr<WaitEvent> wait, 
-              std::shared_ptr<Process> child);
+    ReapEvent(Process& owner, WaitEvent* wait, ProcessId child);
+    ~ReapEvent();
+
+    Process& child() const;
 
     virtual std::string to_string() const;
     virtual void draw(IEventRenderer& renderer) const;
-    virtual const Process& linked_path() const { return *child.get(); }
+    virtual const Process& linked_path() const { return child(); }
     virtual char link_char() const;
     virtual Colour link_colour() const;
 };
@@ -147,12 +231,15 @@ struct ReapEvent : LinkEvent
  * kill, tkill or tgkill). */
 struct RaiseEvent : Event 
 {
+    static constexpr EventKind KIND = EventKind::RAISE;
+
     pid_t killedId; // same meaning as PID argument of kill(2)
     int signal;
     bool toThread; // Was this signal targetted at this specific thread?
 
     RaiseEvent(Process& owner, pid_t dest, int signal, bool toThread)
-        : Event(owner), killedId(dest), signal(signal), toThread(toThread) { }
+        : Event(owner, KIND), killedId(dest), signal(signal), 
+        toThread(toThread) { }
 
     virtual std::string to_string() const;
     virtual void draw(IEventRenderer& renderer) const;
@@ -178,11 +265,13 @@ struct KillInfo
  * shared KillInfo. */
 struct KillEvent : LinkEvent 
 {
+    static constexpr EventKind KIND = EventKind::KILL;
+
     std::shared_ptr<KillInfo> info; // both the sender and receiver need this
     bool sender; // are we the sender, or the receiver?
 
     KillEvent(Process& owner, std::shared_ptr<KillInfo> info, bool sender)
-        : LinkEvent(owner), info(std::move(info)), sender(sender) { }
+        : LinkEvent(owner, KIND), info(std::move(info)), sender(sender) { }
 
     virtual std::string to_string() const;
     virtual void draw(IEventRenderer& renderer) const;
@@ -201,12 +290,14 @@ struct KillEvent : LinkEvent
 /* A process receives a signal, which may or may not kill it. */
 struct SignalEvent : Event 
 {
+    static constexpr EventKind KIND = EventKind::SIGNAL;
+
     pid_t origin; // -1 means don't know, 0 or own pid means self
     int signal; // the value of WTERMSIG / WSTOPSIG
     bool killed;
 
     SignalEvent(Process& owner, pid_t origin, int sig, bool killed) 
-        : Event(owner), origin(origin), signal(sig), killed(killed) { }
+        : Event(owner, KIND), origin(origin), signal(sig), killed(killed) { }
 
     SignalEvent(Process& owner, int sig, bool killed)
         : SignalEvent(owner, -1, sig, killed) { }
@@ -218,9 +309,39 @@ struct SignalEvent : Event
 /* A process exits, causing it to terminate. */
 struct ExitEvent : Event 
 {
+    static constexpr EventKind KIND = EventKind::EXIT;
+
     int status; // the value of WEXITSTATUS
 
-    ExitEvent(Process& owner, int status) : Event(owner), status(status) { }
+    ExitEvent(Process& owner, int status) 
+        : Event(owner, KIND), status(status) { }
+    virtual std::string to_string() const;
+    virtual void draw(IEventRenderer& renderer) const;
+};
+
+/* A process is left out of the trace from here on (along with everything that
+ * it goes on to create), since it went past one of the tracer's limits. We
+ * don't know what happens to it after this, apart from maybe getting reaped. */
+struct DetachEvent : Event 
+{
+    static constexpr EventKind KIND = EventKind::DETACH;
+
+    DetachEvent(Process& owner) : Event(owner, KIND) { }
+    virtual std::string to_string() const;
+    virtual void draw(IEventRenderer& renderer) const;
+};
+
+/* The tracer switched a process (and everything under it) over to lifecycle
+ * tracing from here on, since it was stopping too often. We don't see any of
+ * its waits, kills or signals after this (see Tracer::Options::maxStopRate). */
+struct DowngradeEvent : Event 
+{
+    static constexpr EventKind KIND = EventKind::DOWNGRADE;
+
+    size_t rate; // how many times per second the subtree was stopping
+
+    DowngradeEvent(Process& owner, size_t rate) 
+        : Event(owner, KIND), rate(rate) { }
     virtual std::string to_string() const;
     virtual void draw(IEventRenderer& renderer) const;
 };
@@ -228,11 +349,10 @@ struct ExitEvent : Event
 /* Describes the state of a successful or failed exec call. */
 struct ExecCall 
 {
-    std::string file;
+    std::string_view file; // in the arena of the process that did the exec
     int errcode; // an errno value
 
-    ExecCall(std::string file, int err) 
-        : file(std::move(file)) , errcode(err) { }
+    ExecCall(std::string_view file, int err) : file(file), errcode(err) { }
 
     std::string to_string(const ExecEvent& owner) const;
 };
@@ -245,16 +365,15 @@ struct ExecCall
  * only show the successful one on the diagram. */
 struct ExecEvent : Event 
 {
+    static constexpr EventKind KIND = EventKind::EXEC;
+
     std::vector<ExecCall> calls;
-    std::vector<std::string> args;
+    Argv args;
 
     /* This constructor initialises the event with the first exec call that has
-     * been made for this event. */
-    ExecEvent(Process& owner, 
-              std::string path, 
-              std::vector<std::string> args, 
-              int err)
-        : Event(owner), calls{ExecCall(std::move(path), err)}, 
+     * been made for this event. `path` has to be in the owner's arena. */
+    ExecEvent(Process& owner, std::string_view path, Argv args, int err)
+        : Event(owner, KIND), calls{ExecCall(path, err)}, 
         args(std::move(args)) { }
 
     virtual std::string to_string() const;
@@ -274,4 +393,34 @@ struct ExecEvent : Event
     bool succeeded() const;
 };
 
+/* Returns true if the event is a T (where T is LinkEvent or any of the
+ * concrete event types). */
+template<typename T>
+bool is_event(const Event& event)
+{
+    if constexpr (std::is_same_v<T, LinkEvent>)
+    {
+        return LinkEvent::has_kind(event.kind);
+    }
+    else
+    {
+        return event.kind == T::KIND;
+    }
+}
+
+/* Does the same thing as dynamic_cast, but with the kind tag. Returns null if
+ * the event is null or isn't a T. */
+template<typename T>
+T* event_cast(Event* event)
+{
+    return (event && is_event<T>(*event)) ? static_cast<T*>(event) : nullptr;
+}
+
+template<typename T>
+const T* event_cast(const Event* event)
+{
+    return (event && is_event<T>(*event)) 
+        ? static_cast<const T*>(event) : nullptr;
+}
+
 #endif /* FORKTRACE_EVENT_HPP */
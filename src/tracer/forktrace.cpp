@@ -29,6 +29,8 @@
 #include "process.hpp"
 #include "diagram.hpp"
 #include "scroll-view.hpp"
+#include "stats.hpp"
+#include "../reaper/reaper.h"
 
 using std::string;
 using std::string_view;
@@ -97,15 +99,23 @@ static void signal_thread(Tracer& tracer, sigset_t set)
     assert(!"sigwait shouldn't fail!");
 }
 
-/* It's the caller's responsibility to close the file. This thread reads PIDs
- * of orphaned processes from the reaper (our parent) and lets the tracer know
- * about them. We are reading from the reaper proces. */
-static void reaper_thread(Tracer& tracer, FILE* fromReaper) 
+/* It's the caller's responsibility to close the pipe. This thread reads the
+ * records of orphaned processes from the reaper (our parent) and lets the
+ * tracer know about them (see reaper.h). The reaper sends them in batches, so
+ * we read as many as we can at a time, but a record could still be split up
+ * between two reads. If we get a record that we can't make sense of, then we
+ * fail the trace (see Tracer::notify_orphans_lost), but we keep on reading so
+ * that the reaper doesn't get stuck on a full pipe. */
+static void reaper_thread(Tracer& tracer, int fromReaper) 
 {
+    reaper_record records[64];
+    size_t have = 0; // bytes in records
+    bool lost = false; // true once we've given up on the records
     for (;;) 
     {
-        pid_t pid;
-        if (fread(&pid, sizeof(pid), 1, fromReaper) != 1) 
+        ssize_t n = read(fromReaper, (char*)records + have, 
+                         sizeof(records) - have);
+        if (n <= 0) 
         {
             break;
         }
@@ -113,7 +123,32 @@ static void reaper_thread(Tracer& tracer, FILE* fromReaper)
         {
             break;
         }
-        tracer.notify_orphan(pid);
+        if (lost)
+        {
+            continue; // just throw it away
+        }
+        have += n;
+        size_t count = have / sizeof(reaper_record);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const reaper_record& record = records[i];
+            if (record.version != REAPER_RECORD_VERSION)
+            {
+                tracer.notify_orphans_lost(format("The reaper sent a record "
+                    "with version {} (expected {}). Is the reaper in the $PATH "
+                    "out of date?", record.version, REAPER_RECORD_VERSION));
+                lost = true;
+                break;
+            }
+            ReapInfo info;
+            info.status = record.status;
+            info.startTime = record.startTime;
+            info.time = record.time;
+            info.rusage = record.rusage;
+            tracer.notify_orphan(record.pid, info);
+        }
+        have -= count * sizeof(reaper_record);
+        memmove(records, records + count, have);
     }
 }
 
@@ -139,13 +174,14 @@ failed:
     _exit(1);
 }
 
-static FILE* start_reaper() 
+/* Returns the read end of the pipe from the reaper, or -1 on failure. */
+static int start_reaper() 
 {
     int reaperPipe[2];
     if (pipe(reaperPipe) == -1) 
     {
         error("pipe: {}", strerror_s(errno));
-        return nullptr;
+        return -1;
     }
 
     // We need the close-on-exec flag so that the (read end of the) reap pipe 
@@ -157,7 +193,7 @@ static FILE* start_reaper()
         error("fcntl: {}", strerror_s(errno));
         close(reaperPipe[0]);
         close(reaperPipe[1]);
-        return nullptr;
+        return -1;
     }
 
     pid_t child = fork();
@@ -166,7 +202,7 @@ static FILE* start_reaper()
         error("fork: {}", strerror_s(errno));
         close(reaperPipe[0]);
         close(reaperPipe[1]);
-        return nullptr;
+        return -1;
     }
     if (child != 0) 
     {
@@ -184,17 +220,9 @@ static FILE* start_reaper()
     {
         error("prctl: {}", strerror_s(errno));
         close(reaperPipe[0]);
-        return nullptr;
-    }
-
-    FILE* fromReaper = fdopen(reaperPipe[0], "r");
-    if (!fromReaper) 
-    {
-        error("fdopen: {}", strerror_s(errno));
-        close(reaperPipe[0]);
-        return nullptr;
+        return -1;
     }
-    return fromReaper;
+    return reaperPipe[0];
 }
 
 static void join_sigwaiter(std::thread& sigwaiter)
@@ -209,14 +237,13 @@ static void join_sigwaiter(std::thread& sigwaiter)
     sigwaiter.join();
 }
 
-static void join_reaper(std::thread& reaper, FILE* reaperPipe)
+static void join_reaper(std::thread& reaper, int fd)
 {
     gDone = true;
 
     // To make the reading thread exit, we set the read() file descriptor to
     // be non-blocking so that future calls to read() end immediately. We then
     // interrupt the current read() call with a signal (SA_RESTART not set).
-    int fd = fileno(reaperPipe);
     int flags = fcntl(fd, F_GETFL);
     if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
     {
@@ -247,7 +274,7 @@ static void do_tree(Forktrace& ft, vector<string> args)
         for (size_t i = 0; i < ft.trees.size(); ++i)
         {
             std::cerr << colour(Colour::BOLD, format("Process tree {}:\n", i));
-            ft.trees[i]->print_tree();
+            ft.trees[i]->root().print_tree();
         }
     }
     else
@@ -257,7 +284,7 @@ static void do_tree(Forktrace& ft, vector<string> args)
         {
             throw runtime_error("Out-of-bounds process tree index.");
         }
-        ft.trees[i]->print_tree();
+        ft.trees[i]->root().print_tree();
     }
 }
 
@@ -269,7 +296,7 @@ static void do_trees(Forktrace& ft)
     }
     for (size_t i = 0; i < ft.trees.size(); ++i)
     {
-        std::cerr << format("{}: {}\n", i, ft.trees[i]->to_string());
+        std::cerr << format("{}: {}\n", i, ft.trees[i]->root().to_string());
     }
 }
 
@@ -290,12 +317,12 @@ static string get_event_info(const Event* selected)
     {
         return "";
     }
-    if (!selected->location.has_value()) 
+    const SourceLocation* location = selected->location();
+    if (!location) 
     {
         return selected->to_string();
     }
-    return format("{} @ {}", 
-        selected->to_string(), selected->location->to_string());
+    return format("{} @ {}", selected->to_string(), location->to_string());
 }
 
 /* Helper function for view(). Returns a string describing the currently 
@@ -435,7 +462,7 @@ static void draw_tree(Forktrace& ft,
     {
         flags |= Diagram::MERGE_EXECS;
     }
-    Diagram diagram(*ft.trees.at(treeIndex).get(), ft.opts.laneWidth, flags);
+    Diagram diagram(ft.trees.at(treeIndex)->root(), ft.opts.laneWidth, flags);
     drawer(diagram);
     if (diagram.truncated())
     {
@@ -483,6 +510,33 @@ static void do_start(Forktrace& ft, vector<string> args)
     ft.trees.push_back(ft.tracer.start(args[0], args));
 }
 
+static void do_attach(Forktrace& ft, string pid)
+{
+    ft.trees.push_back(ft.tracer.attach(parse_number<pid_t>(pid)));
+}
+
+static void do_lifecycle(Forktrace& ft, bool lifecycle)
+{
+    ft.opts.lifecycle = lifecycle;
+    ft.tracer.set_lifecycle(lifecycle);
+}
+
+static void do_stats(vector<string> args)
+{
+    if (args.empty())
+    {
+        std::cerr << format_stats();
+    }
+    else if (args.size() == 1 && args[0] == "reset")
+    {
+        reset_stats();
+    }
+    else
+    {
+        throw runtime_error("Expected: [reset]");
+    }
+}
+
 static void do_go(Forktrace& ft)
 {
     while (ft.tracer.step())
@@ -547,6 +601,10 @@ static void register_commands(Forktrace& ft)
     parser.add("log", "on|off", "enable/disable general log messages",
         [](string s) { set_log_category_enabled(Log::LOG, parse_bool(s)); }
     );
+    parser.add("stats", "[reset]",
+        "print (or reset) counts of where the tracer has spent its time",
+        [](vector<string> args) { do_stats(std::move(args)); }
+    );
 
     parser.start_new_group("Process tree");
 
@@ -578,6 +636,14 @@ static void register_commands(Forktrace& ft)
     parser.add("start", "PROGRAM [ARGS...]", "start a tracee program",
         [&](vector<string> args) { do_start(ft, std::move(args)); }
     );
+    parser.add("attach", "PID", "start tracing a running process (and its "
+        "descendants)",
+        [&](string pid) { do_attach(ft, std::move(pid)); }
+    );
+    parser.add("lifecycle", "on|off", 
+        "only trace forks, execs and exits of trees started from now on",
+        [&](string s) { do_lifecycle(ft, parse_bool(s)); }
+    );
     parser.add("run", "PROGRAM [ARGS...]", 
         "equivalent to \"start\" followed by \"go\"",
         [&](vector<string> args) { do_run(ft, std::move(args)); }
@@ -671,25 +737,37 @@ static void command_line(Forktrace& ft)
 
 static bool run(Tracer& tracer, Forktrace::Options& opts, vector<string> command)
 {
-    vector<shared_ptr<Process>> trees; // root of each process tree
+    vector<shared_ptr<ProcessTree>> trees;
     CommandParser cmdline;
 
     // Bundles up references to all the state so others can access it
     Forktrace ft(opts, tracer, cmdline, trees);
     register_commands(ft);
 
-    if (command.empty())
+    if (opts.attach != 0 && !command.empty())
+    {
+        error("Can't run a command and attach to a process at the same time.");
+        return false;
+    }
+    if (command.empty() && opts.attach == 0)
     {
         verbose("No command provided. Going into command line mode.");
         command_line(ft);
     }
     else
     {
-        log("Starting the command: {}", join(command));
         try
         {
-            assert(!command.empty());
-            trees.push_back(tracer.start(command[0], command));
+            if (opts.attach != 0)
+            {
+                log("Attaching to {}", opts.attach);
+                trees.push_back(tracer.attach(opts.attach));
+            }
+            else
+            {
+                log("Starting the command: {}", join(command));
+                trees.push_back(tracer.start(command[0], command));
+            }
             do_go(ft);
             if (opts.forceScrollView)
             {
@@ -718,6 +796,12 @@ bool forktrace(vector<string> command, Forktrace::Options opts)
     atexit(restore_terminal);
     register_signals();
 
+    if (opts.subreaper && !opts.reaper)
+    {
+        error("Can't use --subreaper and --no-reaper at the same time.");
+        return false;
+    }
+
     /* Block SIGINT so it doesn't kill us (we want to sigwait it). We need to
      * do this before creating the sigwait thread and the reaper thread (via
      * start_reaper) so that all threads inherit it. We also do it before we
@@ -730,12 +814,14 @@ bool forktrace(vector<string> command, Forktrace::Options opts)
 
     /* This will fork the reaper process as the parent. When the call is done,
      * we will be running as the child!!! (We'll have a different PID!!!). We
-     * also start the reaper thread, which reads from pipe onto the queue. */
-    FILE* reaperPipe;
+     * also start the reaper thread, which reads from pipe onto the queue. We
+     * don't need any of this if the tracer is going to be the subreaper. */
+    int reaperPipe;
     std::optional<std::thread> reaper;
-    if (opts.reaper)
+    bool reaperProcess = opts.reaper && !opts.subreaper;
+    if (reaperProcess)
     {
-        if (!(reaperPipe = start_reaper()))
+        if ((reaperPipe = start_reaper()) == -1)
         {
             error("Failed to start reaper.");
             return false;
@@ -744,20 +830,32 @@ bool forktrace(vector<string> command, Forktrace::Options opts)
     log("Hello, I'm {}", getpid());
 
     /* Start the reaper and sigwait threads. */
-    Tracer tracer;
-    if (opts.reaper)
+    Tracer::Options tracerOpts;
+    tracerOpts.seccomp = opts.seccomp;
+    tracerOpts.subreaper = opts.subreaper;
+    tracerOpts.maxDepth = opts.maxDepth;
+    tracerOpts.maxProcesses = opts.maxProcesses;
+    tracerOpts.onlySubtree = opts.onlySubtree;
+    tracerOpts.lifecycle = opts.lifecycle;
+    tracerOpts.maxStopRate = opts.maxStopRate;
+    Tracer tracer(tracerOpts);
+    if (reaperProcess)
     {
         reaper.emplace(reaper_thread, std::ref(tracer), reaperPipe);
     }
     std::thread sigwaiter(signal_thread, std::ref(tracer), set);
 
     bool ok = run(tracer, opts, std::move(command));
+    if (opts.stats)
+    {
+        std::cerr << format_stats();
+    }
 
     join_sigwaiter(sigwaiter);
-    if (opts.reaper)
+    if (reaperProcess)
     {
         join_reaper(reaper.value(), reaperPipe);
-        fclose(reaperPipe);
+        close(reaperPipe);
     }
 
     return ok;
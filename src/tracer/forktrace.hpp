@@ -7,10 +7,15 @@
 #ifndef FORKTRACE_FORKTRACE_HPP
 #define FORKTRACE_FORKTRACE_HPP
 
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <unistd.h>
 
-class Process; // defined in process.hpp
+class ProcessTree; // defined in process.hpp
 class Tracer; // defined in tracer.hpp
 class CommandParser; // defined in command.hpp
 
@@ -27,6 +32,39 @@ struct Forktrace
          * bound. Also see the do_go() function in forktrace.cpp. */
         bool reaper = true;
 
+        /* If true, then instead of starting the reaper process, the tracer
+         * makes itself the subreaper and reaps orphans in its own wait loop
+         * (see Tracer::Options). This is an error if reaper is false. */
+        bool subreaper = false;
+
+        /* If false then we don't use a seccomp filter to avoid stopping the
+         * tracees on syscalls that we don't care about. (See ptrace.hpp). */
+        bool seccomp = true;
+
+        /* If this isn't 0, then instead of running a command, we attach to
+         * the process with this PID and trace it until it ends (see Tracer::
+         * attach in tracer.hpp). */
+        pid_t attach = 0;
+
+        /* Limits on what gets traced. Anything past them gets detached from
+         * (see Tracer::Options in tracer.hpp). */
+        size_t maxDepth = SIZE_MAX;
+        size_t maxProcesses = SIZE_MAX;
+        std::optional<std::regex> onlySubtree;
+
+        /* If true, then only forks, execs and exits get traced, which is much
+         * faster (see Tracer::Options in tracer.hpp). */
+        bool lifecycle = false;
+
+        /* If this isn't 0, then subtrees that stop more often than this many
+         * times a second get switched to lifecycle tracing (see Tracer::
+         * Options in tracer.hpp). */
+        size_t maxStopRate = 0;
+
+        /* If true, then we print the tracer's counters (see stats.hpp) once
+         * everything is done. */
+        bool stats = false;
+
         /* Diagram options. */
         bool showNonFatalSignals = false;
         bool showExecs = true;
@@ -43,7 +81,7 @@ struct Forktrace
     Options& opts;
     Tracer& tracer;
     CommandParser& parser;
-    std::vector<std::shared_ptr<Process>>& trees;
+    std::vector<std::shared_ptr<ProcessTree>>& trees;
 
     Forktrace(Options& opts,
               Tracer& tracer, 
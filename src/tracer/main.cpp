@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <optional>
 #include <memory>
+#include <regex>
 
 #include "util.hpp"
 #include "log.hpp"
@@ -533,6 +534,21 @@ static void diagnose_status(int wstatus)
     std::cerr << diagnose_wait_status(wstatus) << '\n';
 }
 
+/* Compiles the pattern for --only-subtree. (The std::regex_error on its own
+ * doesn't say which option or pattern it was about.) */
+static std::regex parse_subtree_regex(const string& pattern)
+{
+    try
+    {
+        return std::regex(pattern);
+    }
+    catch (const std::regex_error& e)
+    {
+        throw OptionError("Option \"--only-subtree\" got a bad regex '{}': {}",
+            pattern, e.what());
+    }
+}
+
 /* This feature is useful for debugging */
 static void print_syscall(int syscall)
 {
@@ -543,15 +559,43 @@ static void print_syscall(int syscall)
 /* Registers all of our command line options with the argparser. */
 static void register_options(ArgParser& parser, Forktrace::Options& opts)
 {
+    parser.add("attach", "PID", "trace a running process instead of a command",
+        [&](string s) { opts.attach = parse_number<pid_t>(s); }
+    );
+    parser.add("lifecycle", "", "only trace forks, execs and exits (faster)",
+        [&]{ opts.lifecycle = true; }
+    );
+    parser.add("max-depth", "N", "detach from processes deeper than N",
+        [&](string s) { opts.maxDepth = parse_number<size_t>(s); }
+    );
+    parser.add("max-processes", "N", "detach from new processes after N",
+        [&](string s) { opts.maxProcesses = parse_number<size_t>(s); }
+    );
+    parser.add("max-stop-rate", "N", "lifecycle trace subtrees above N stops/s",
+        [&](string s) { opts.maxStopRate = parse_number<size_t>(s); }
+    );
     parser.add("no-colour", 'c', "", "disables colours", 
         []{ set_colour_enabled(false); }
     );
     parser.add("no-reaper", "", "disables the sub-reaper process",
         [&]{ opts.reaper = false; }
     );
+    parser.add("no-seccomp", "", "trace every syscall (no seccomp filter)",
+        [&]{ opts.seccomp = false; }
+    );
+    parser.add("only-subtree", "REGEX", 
+        "only trace the subtrees of processes that exec a match",
+        [&](string s) { opts.onlySubtree = parse_subtree_regex(s); }
+    );
+    parser.add("stats", "", "print counts of the tracer's work when done",
+        [&]{ opts.stats = true; }
+    );
     parser.add("status", "STATUS", "diagnose a wait(2) child status",
         [&](string s) { diagnose_status(parse_number<int>(s)); parser.schedule_exit(); }
     );
+    parser.add("subreaper", "", "reap orphans in forktrace (no reaper process)",
+        [&]{ opts.subreaper = true; }
+    );
     parser.add("syscall", "NUMBER", "print info about a syscall number",
         [&](string s) { print_syscall(parse_number<int>(s)); parser.schedule_exit(); }
     );
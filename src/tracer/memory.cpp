@@ -0,0 +1,460 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  memory
+ *
+ *      Reading from (and writing to) the address space of a tracee. We always
+ *      read up until the end of a page at most (per region) since a page is
+ *      either readable in its entirety or not at all. That way we never get a
+ *      failed read for a string just because we happened to read past where
+ *      it ended. Writes go through process_vm_writev first, and fall back to
+ *      /proc/<pid>/mem and then PTRACE_POKEDATA (for read-only pages, or if
+ *      process_vm_writev can't be used at all).
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <fmt/core.h>
+
+#include "memory.hpp"
+#include "ptrace.hpp"
+#include "system.hpp"
+#include "stats.hpp"
+#include "log.hpp"
+
+using std::string;
+using std::vector;
+using fmt::format;
+
+/* Same as in ptrace.cpp. */
+static const size_t SYS_PAGE_SIZE = sysconf(_SC_PAGESIZE);
+
+/* The maximum number of regions that we can give to process_vm_readv at once
+ * (any more and it will fail with EINVAL). */
+constexpr size_t MAX_REGIONS = IOV_MAX;
+
+/* Set to false the first time that process_vm_readv/writev fails with an
+ * error that tells us we aren't allowed to use it at all (e.g., ENOSYS if it
+ * wasn't compiled into the kernel or EPERM if we're inside a sandbox that bans
+ * it). There's no point retrying it for every read/write in that case. */
+static std::atomic<bool> vmReadWorks(true);
+static std::atomic<bool> vmWriteWorks(true);
+
+/* Returns the number of bytes from `addr` up until the start of the next page
+ * (i.e., the most that we can read from `addr` without crossing a page). */
+static size_t bytes_left_in_page(const void* addr)
+{
+    return SYS_PAGE_SIZE - ((size_t)addr & (SYS_PAGE_SIZE - 1));
+}
+
+/* Checks the errno from a failed process_vm_readv/writev (named `func`).
+ * Returns false for ESRCH, returns true if it's worth trying another method,
+ * and throws otherwise. `works` is cleared if `func` can't be used at all. */
+static bool check_vm_error(int err, const char* func, std::atomic<bool>& works)
+{
+    switch (err)
+    {
+        case ESRCH:
+            return false;
+        case ENOSYS:
+        case EPERM:
+            debug("{} unusable ({}), falling back to slower methods for "
+                  "accessing tracee memory.", func, strerror(err));
+            works = false;
+            return true;
+        case EFAULT:
+            // We'll let the other methods decide whether the address is truly
+            // bad (they'll throw their own error if it is). They're able to
+            // access pages that the tracee itself can't, unlike this one.
+            return true;
+        default:
+            throw SystemError(err, func);
+    }
+}
+
+TraceeMemory::TraceeMemory(pid_t pid)
+    : _pid(pid), _memFd(-1), _memFailed(false) { }
+
+TraceeMemory::TraceeMemory(TraceeMemory&& other)
+    : _pid(other._pid), _memFd(other._memFd), _memFailed(other._memFailed)
+{
+    other._memFd = -1;
+}
+
+TraceeMemory::~TraceeMemory()
+{
+    reset();
+}
+
+void TraceeMemory::reset()
+{
+    if (_memFd != -1)
+    {
+        close(_memFd);
+        _memFd = -1;
+    }
+    _memFailed = false;
+}
+
+/* Opens /proc/<pid>/mem if it isn't open yet. Returns false if the file
+ * couldn't be opened (in which case we won't try again until reset). */
+bool TraceeMemory::_open_mem()
+{
+    if (_memFd != -1)
+    {
+        return true;
+    }
+    if (_memFailed)
+    {
+        return false;
+    }
+    string path = format("/proc/{}/mem", _pid);
+    _memFd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (_memFd == -1)
+    {
+        debug("Couldn't open {}: {}", path, strerror(errno));
+        _memFailed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Reads from /proc/<pid>/mem (which must already be open). Will only return
+ * false if the tracee's address space has disappeared (it has exited). */
+bool TraceeMemory::_read_proc_mem(void* dest, const void* src, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        count_memory_call(MemoryCall::MEM_READ);
+        ssize_t n = pread(_memFd, (char*)dest + done, len - done,
+                          (off_t)((size_t)src + done));
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw SystemError(errno, "pread(/proc/<pid>/mem)"); // EIO if bad
+        }
+        if (n == 0)
+        {
+            return false; // the tracee's memory is gone (i.e., it's dead)
+        }
+        count_bytes_copied(n);
+        done += n;
+    }
+    return true;
+}
+
+/* Same as _read_proc_mem but for writing. */
+bool TraceeMemory::_write_proc_mem(void* dest, const void* src, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        count_memory_call(MemoryCall::MEM_WRITE);
+        ssize_t n = pwrite(_memFd, (const char*)src + done, len - done,
+                           (off_t)((size_t)dest + done));
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw SystemError(errno, "pwrite(/proc/<pid>/mem)"); // EIO if bad
+        }
+        if (n == 0)
+        {
+            return false; // the tracee's memory is gone (i.e., it's dead)
+        }
+        done += n;
+    }
+    return true;
+}
+
+/* Reads the region using whatever method works best. */
+bool TraceeMemory::_read(void* dest, const void* src, size_t len)
+{
+    size_t done = 0;
+    if (vmReadWorks)
+    {
+        struct iovec local = { dest, len };
+        struct iovec remote = { (void*)src, len };
+        count_memory_call(MemoryCall::VM_READV);
+        ssize_t n = process_vm_readv(_pid, &local, 1, &remote, 1, 0);
+        count_bytes_copied(std::max<ssize_t>(n, 0));
+        if (n == (ssize_t)len)
+        {
+            return true;
+        }
+        if (n == -1 && !check_vm_error(errno, "process_vm_readv", vmReadWorks))
+        {
+            return false;
+        }
+        done = (n == -1) ? 0 : n;
+    }
+    if (_open_mem())
+    {
+        return _read_proc_mem((char*)dest + done, (const char*)src + done,
+                              len - done);
+    }
+    return copy_from_tracee(_pid, (char*)dest + done, (char*)src + done,
+                            len - done);
+}
+
+/* Writes the region using whatever method works best. */
+bool TraceeMemory::_write(void* dest, const void* src, size_t len)
+{
+    size_t done = 0;
+    if (vmWriteWorks)
+    {
+        struct iovec local = { (void*)src, len };
+        struct iovec remote = { dest, len };
+        count_memory_call(MemoryCall::VM_WRITEV);
+        ssize_t n = process_vm_writev(_pid, &local, 1, &remote, 1, 0);
+        if (n == (ssize_t)len)
+        {
+            return true;
+        }
+        if (n == -1 
+            && !check_vm_error(errno, "process_vm_writev", vmWriteWorks))
+        {
+            return false;
+        }
+        done = (n == -1) ? 0 : n;
+    }
+    if (_open_mem())
+    {
+        return _write_proc_mem((char*)dest + done, (const char*)src + done,
+                               len - done);
+    }
+    return copy_to_tracee(_pid, (char*)dest + done, (char*)src + done,
+                          len - done);
+}
+
+/* Reads a bunch of regions into `dest` (back-to-back) using as few syscalls
+ * as possible. Stores the number of bytes that were read in `count`. This
+ * will stop early at the first region that can't be read (or it will read
+ * nothing at all if process_vm_readv can't be used). So the caller has to
+ * check `count` and read the rest some other way. Returns false if the tracee
+ * doesn't exist anymore. */
+bool TraceeMemory::_readv(char* dest,
+                          const vector<struct iovec>& remote,
+                          size_t& count)
+{
+    count = 0;
+    for (size_t i = 0; i < remote.size() && vmReadWorks; i += MAX_REGIONS)
+    {
+        size_t regions = std::min(MAX_REGIONS, remote.size() - i);
+        size_t len = 0;
+        for (size_t j = i; j < i + regions; ++j)
+        {
+            len += remote[j].iov_len;
+        }
+
+        struct iovec local = { dest + count, len };
+        count_memory_call(MemoryCall::VM_READV);
+        ssize_t n = process_vm_readv(_pid, &local, 1, &remote[i], regions, 0);
+        if (n == -1)
+        {
+            return check_vm_error(errno, "process_vm_readv", vmReadWorks);
+        }
+        count_bytes_copied(n);
+        count += n;
+        if ((size_t)n < len)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+/* Reads a null-terminated string and appends it onto the end of `result`. */
+bool TraceeMemory::_read_string_from(const char* src, string& result)
+{
+    if (!vmReadWorks && !_open_mem())
+    {
+        // Reading entire pages one word at a time would be silly, so just let
+        // the PTRACE_PEEKDATA version do it (it stops at the terminator).
+        string rest;
+        if (!copy_string_from_tracee(_pid, src, rest))
+        {
+            return false;
+        }
+        result += rest;
+        return true;
+    }
+
+    vector<char> buffer(SYS_PAGE_SIZE);
+    for (;;)
+    {
+        size_t len = bytes_left_in_page(src);
+        if (!_read(buffer.data(), src, len))
+        {
+            return false;
+        }
+        const char* end = (const char*)memchr(buffer.data(), '\0', len);
+        if (end != nullptr)
+        {
+            result.append((const char*)buffer.data(), end);
+            return true;
+        }
+        result.append(buffer.data(), len);
+        src += len;
+    }
+}
+
+bool TraceeMemory::read(void* dest, const void* src, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    return _read(dest, src, len);
+}
+
+bool TraceeMemory::read_string(const char* src, string& result)
+{
+    result.clear();
+    if (!_read_string_from(src, result))
+    {
+        return false;
+    }
+    return true;
+}
+
+bool TraceeMemory::read_strings(const vector<const char*>& srcs,
+                                vector<string>& result)
+{
+    result.clear();
+    result.resize(srcs.size());
+
+    // Work out the regions that need to be read. Each string needs everything
+    // from its start up until the end of its page (at least). Strings sharing
+    // a page (or on neighbouring pages) are covered by a single region.
+    vector<const char*> sorted(srcs);
+    std::sort(sorted.begin(), sorted.end());
+    vector<struct iovec> regions;
+    vector<size_t> offsets; // offset of each region in the buffer
+    size_t total = 0;
+    for (const char* src : sorted)
+    {
+        size_t addr = (size_t)src;
+        size_t end = addr + bytes_left_in_page(src);
+        if (!regions.empty())
+        {
+            struct iovec& last = regions.back();
+            size_t lastEnd = (size_t)last.iov_base + last.iov_len;
+            if (addr < lastEnd)
+            {
+                continue; // already covered
+            }
+            if (addr < lastEnd + SYS_PAGE_SIZE)
+            {
+                total += end - lastEnd;
+                last.iov_len = end - (size_t)last.iov_base;
+                continue;
+            }
+        }
+        regions.push_back({ (void*)src, end - addr });
+        offsets.push_back(total);
+        total += end - addr;
+    }
+
+    size_t count;
+    vector<char> buffer(total);
+    if (!_readv(buffer.data(), regions, count))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < srcs.size(); ++i)
+    {
+        // Find the region that contains this string
+        size_t addr = (size_t)srcs[i];
+        auto it = std::upper_bound(regions.begin(), regions.end(), addr,
+            [](size_t addr, const struct iovec& region)
+            {
+                return addr < (size_t)region.iov_base;
+            });
+        size_t index = (it - regions.begin()) - 1;
+        size_t start = offsets[index] + (addr - (size_t)regions[index].iov_base);
+        size_t limit = std::min(offsets[index] + regions[index].iov_len, count);
+
+        if (start < limit)
+        {
+            const char* str = buffer.data() + start;
+            const char* end = (const char*)memchr(str, '\0', limit - start);
+            if (end != nullptr)
+            {
+                result[i].assign(str, end);
+                continue;
+            }
+            result[i].assign(str, limit - start);
+        }
+
+        // Whatever is left over wasn't covered by the bulk read (either the
+        // string ran past the region or the read stopped before getting here).
+        if (!_read_string_from(srcs[i] + result[i].size(), result[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceeMemory::read_string_array(const char* const* src,
+                                     vector<string>& result)
+{
+    result.clear();
+    if (!vmReadWorks && !_open_mem())
+    {
+        return copy_string_array_from_tracee(_pid, (const char**)src, result);
+    }
+
+    // Collect the pointers first (a page's worth at a time), and then read all
+    // of the strings that they point to in one go.
+    vector<const char*> ptrs;
+    vector<const char*> buffer(SYS_PAGE_SIZE / sizeof(char*));
+    for (;;)
+    {
+        size_t count = std::max<size_t>(1,
+            bytes_left_in_page(src) / sizeof(char*));
+        if (!_read(buffer.data(), src, count * sizeof(char*)))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (buffer[i] == nullptr)
+            {
+                return read_strings(ptrs, result);
+            }
+            ptrs.push_back(buffer[i]);
+        }
+        src += count;
+    }
+}
+
+bool TraceeMemory::write(void* dest, const void* src, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    return _write(dest, src, len);
+}
+
+bool TraceeMemory::fill(void* dest, uint8_t value, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    vector<uint8_t> buffer(len, value);
+    return _write(dest, buffer.data(), len);
+}
@@ -0,0 +1,88 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  memory
+ *
+ *      Reading from (and writing to) the address space of a tracee. The ones
+ *      in ptrace.hpp need one ptrace syscall per machine word, which adds up
+ *      really quickly for things like big argv arrays. This does the same job
+ *      in page-sized chunks (and batches of chunks) instead.
+ */
+#ifndef FORKTRACE_MEMORY_HPP
+#define FORKTRACE_MEMORY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* Provides access to the memory of a single tracee. Each read will be tried
+ * with the following methods (falling through to the next if unavailable):
+ *
+ *      (1) process_vm_readv: Lets us read many regions in a single syscall.
+ *      (2) /proc/<pid>/mem: We keep the file open between reads.
+ *      (3) PTRACE_PEEKDATA: The functions in ptrace.hpp (one word at a time).
+ *
+ * Writes work the same way using process_vm_writev, /proc/<pid>/mem and then
+ * PTRACE_POKEDATA. The first one isn't allowed to write to read-only pages
+ * (just like the tracee itself) but the other two are, so we fall through
+ * to /proc/<pid>/mem in that case too.
+ *
+ * The error handling is the same as the functions in ptrace.hpp - a function
+ * will throw a SystemError on failure (EFAULT or EIO for bad addresses), and
+ * will return false if the tracee doesn't exist anymore. The tracee should be
+ * in a ptrace-stop when any of these functions are called. */
+class TraceeMemory
+{
+private:
+    pid_t _pid;
+    int _memFd; // cached /proc/<pid>/mem file, -1 if it's not open (yet)
+    bool _memFailed; // true if we weren't able to open /proc/<pid>/mem
+
+    /* Private functions, see source file */
+    bool _open_mem();
+    bool _read_proc_mem(void* dest, const void* src, size_t len);
+    bool _write_proc_mem(void* dest, const void* src, size_t len);
+    bool _read(void* dest, const void* src, size_t len);
+    bool _write(void* dest, const void* src, size_t len);
+    bool _readv(char* dest, const std::vector<struct iovec>& remote,
+                size_t& count);
+    bool _read_string_from(const char* src, std::string& result);
+
+public:
+    TraceeMemory(pid_t pid);
+    TraceeMemory(TraceeMemory&&);
+    TraceeMemory(const TraceeMemory&) = delete;
+    ~TraceeMemory();
+
+    /* Call this when the tracee has successfully exec'd. The tracee has a new
+     * address space after exec, so anything that we've cached (such as the
+     * open /proc/<pid>/mem file) will no longer refer to the right thing. */
+    void reset();
+
+    /* Copies a block of memory from the tracee's address space into ours. */
+    bool read(void* dest, const void* src, size_t len);
+
+    /* Copies a null-terminated string from the tracee's address space. */
+    bool read_string(const char* src, std::string& result);
+
+    /* Copies a bunch of null-terminated strings from the tracee. The strings
+     * that are near each other (e.g., argv strings, which are usually packed
+     * together on the stack) are read together with a single syscall. Stores
+     * the strings in `result` in the same order as `srcs`. */
+    bool read_strings(const std::vector<const char*>& srcs,
+                      std::vector<std::string>& result);
+
+    /* Copies a null-terminated string array (such as the argv or envp arrays)
+     * from the tracee's address space and stores the result in `result`. */
+    bool read_string_array(const char* const* src,
+                           std::vector<std::string>& result);
+
+    /* Copies a block of memory from our address space into the tracee's. */
+    bool write(void* dest, const void* src, size_t len);
+
+    /* Sets a block of memory within the tracee's address space to `value`. */
+    bool fill(void* dest, uint8_t value, size_t len);
+};
+
+#endif /* FORKTRACE_MEMORY_HPP */
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <algorithm>
 #include <iostream>
 #include <fmt/core.h>
 #include <unistd.h>
@@ -11,9 +12,6 @@
 using std::string;
 using std::string_view;
 using std::vector;
-using std::unique_ptr;
-using std::shared_ptr;
-using std::make_unique;
 using std::make_shared;
 using fmt::format;
 
@@ -28,14 +26,15 @@ void process_assert(bool cond, std::string_view fmt, Args... args)
     }
 }
 
-Process::Process(pid_t pid, const shared_ptr<Process>& parent)
-    : _pid(pid), _parent(parent), _state(State::ALIVE), _killed(false)
+Process::Process(ProcessTree& tree, ProcessId id, pid_t pid, Process& parent)
+    : _tree(tree), _id(id), _parent(parent._id), _pid(pid), 
+    _state(State::ALIVE), _killed(false), _location(NO_LOCATION), _hidden(0)
 {
-    const ExecEvent* lastExec = parent->_most_recent_exec();
+    const ExecEvent* lastExec = parent._most_recent_exec();
     if (!lastExec) 
     {
-        _initialName = parent->_initialName;
-        _initialArgs = parent->_initialArgs;
+        _initialName = parent._initialName;
+        _initialArgs = parent._initialArgs;
     } 
     else 
     {
@@ -44,6 +43,15 @@ Process::Process(pid_t pid, const shared_ptr<Process>& parent)
     }
 }
 
+Process::~Process()
+{
+    // The arena frees the memory, but it doesn't run destructors.
+    for (Event* event : _events)
+    {
+        event->~Event();
+    }
+}
+
 /* Will do a reverse search to find the most recent successful exec event for 
  * this process, and will return null if it couldn't be found. The pointer will
  * become invalid if the event is removed from our list. If startIndex is
@@ -62,7 +70,7 @@ const ExecEvent* Process::_most_recent_exec(int startIndex) const
     startIndex--;
     for (long i = startIndex; i >= 0; --i) 
     {
-        if (auto exec = dynamic_cast<const ExecEvent*>(_events.at(i).get()))
+        if (auto exec = event_cast<ExecEvent>(_events.at(i)))
         {
             if (exec->succeeded()) 
             {
@@ -73,37 +81,62 @@ const ExecEvent* Process::_most_recent_exec(int startIndex) const
     return nullptr;
 }
 
-/* Add this event to the list and log it out. Throws ProcessTreeError if the
- * process has already ended. If `consumeLocation` is true, then the current
- * source location is **moved** into the provided event if it exists. Events
- * can only be added if the process is alive. */
-void Process::_add_event(unique_ptr<Event> event, bool consumeLocation) 
+/* Add this event (which must have come from our arena) to the list and log
+ * it out. Throws ProcessTreeError if the process has already ended. If
+ * `consumeLocation` is true, then the current source location is **moved**
+ * into the provided event if it exists. Events can only be added if the
+ * process is alive. */
+void Process::_add_event(Event* event, bool consumeLocation) 
 {
-    process_assert(_state == State::ALIVE,
-        "_add_event({}) called when state != ALIVE", event->to_string());
-    if (_location.has_value() && consumeLocation)
+    if (_state != State::ALIVE)
+    {
+        string str = event->to_string();
+        event->~Event(); // since it isn't going to end up in _events
+        process_assert(false, "_add_event({}) called when state != ALIVE", str);
+    }
+    _events.push_back(event);
+    _update_event(event);
+    if (_location != NO_LOCATION && consumeLocation)
     {
-        log("{} @ {}", event->to_string(), _location->to_string());
-        event->location = std::move(_location);
-        _location.reset();
+        log("{} @ {}", event->to_string(), 
+            get_location(_location).to_string());
+        event->locationId = _location;
+        _location = NO_LOCATION;
     }
     else
     {
         log("{}", event->to_string());
     }
-    _events.push_back(std::move(event));
 }
 
-void Process::notify_waiting(pid_t waitedId, bool nohang) 
+/* Call this whenever an event has been added to the list, moved around in it,
+ * or changed in a way that could change whether it's visible. */
+void Process::_update_event(Event* event)
+{
+    event->classify();
+    _nextVisible.clear();
+}
+
+/* Takes a child off _unreaped once it's been reaped or orphaned. */
+void Process::_forget_child(ProcessId child)
+{
+    auto it = std::find(_unreaped.begin(), _unreaped.end(), child);
+    if (it != _unreaped.end())
+    {
+        _unreaped.erase(it);
+    }
+}
+
+void Process::notify_waiting(pid_t waitedId, bool nohang, pid_t tid) 
 {
     // If the very last event was a failed wait event with ERESTARTSYS, then
     // we'll just merge the two together (we only really care about showing
     // them separately when another event appears in between them).
     if (!_events.empty()) 
     {
-        if (auto wait = dynamic_cast<WaitEvent*>(_events.back().get())) 
+        if (auto wait = event_cast<WaitEvent>(_events.back())) 
         {
-            if (wait->error == ERESTARTSYS) 
+            if (wait->error == ERESTARTSYS && wait->tid == tid) 
             {
                 bool same = wait->waitedId == waitedId 
                     && wait->nohang == nohang;
@@ -116,15 +149,16 @@ void Process::notify_waiting(pid_t waitedId, bool nohang)
             }
         }
     }
-    _add_event(make_unique<WaitEvent>(*this, waitedId, nohang), true);
+    _add_event(_arena.make<WaitEvent>(*this, waitedId, nohang, tid), true);
 }
 
-void Process::notify_failed_wait(int error) 
+void Process::notify_failed_wait(int error, pid_t tid) 
 {
     // search backwards to find the WaitEvent that started the failed wait
-    for (size_t i = _events.size() - 1; i >= 0; --i) 
+    for (size_t i = _events.size(); i-- > 0; )
     {
-        if (auto wait = dynamic_cast<WaitEvent*>(_events[i].get())) 
+        auto wait = event_cast<WaitEvent>(_events[i]);
+        if (wait && wait->tid == tid) 
         {
             process_assert(wait->error == 0, "notify_failed_wait(\"{}\"): "
                 "the previous WaitEvent already failed", strerror_s(error));
@@ -137,63 +171,102 @@ void Process::notify_failed_wait(int error)
         "initial wait event that failed", strerror_s(error));
 }
 
-void Process::notify_reaped(shared_ptr<Process> child) 
+void Process::notify_reaped(Process& child, pid_t tid) 
 {
-    process_assert(child->_state == State::ZOMBIE,
-        "notify_reaped({}) called on non-zombie process", child->to_string());
-    child->_state = State::REAPED;
+    process_assert(child._state == State::ZOMBIE 
+        || child._state == State::DETACHED,
+        "notify_reaped({}) called on non-zombie process", child.to_string());
+    child._state = State::REAPED;
+    _forget_child(child._id);
 
     // search backwards to find the WaitEvent that started this wait
-    for (size_t i = _events.size() - 1; i >= 0; --i)
+    for (size_t i = _events.size(); i-- > 0; )
     {
-        if (auto wait = dynamic_cast<WaitEvent*>(_events[i].get())) 
+        auto wait = event_cast<WaitEvent>(_events[i]);
+        if (wait && wait->tid == tid) 
         {
             process_assert(wait->error == 0, "notify_reaped({}) called when "
-                "the last WaitEvent failed", child->to_string());
+                "the last WaitEvent failed", child.to_string());
+
+            // If another thread forked the child after this wait started,
+            // then the reap has to go after that (or else we'd be reaping a
+            // child that doesn't exist yet), so move the whole thing to the
+            // end. We lose the waiting bit in between, but oh well.
+            for (size_t j = i + 1; j < _events.size(); ++j)
+            {
+                auto fork = event_cast<ForkEvent>(_events[j]);
+                if (fork && fork->childId == child._id)
+                {
+                    _events.erase(_events.begin() + i);
+                    _events.push_back(wait);
+                    _update_event(wait);
+                    i = _events.size() - 1;
+                    break;
+                }
+            }
 
             // We'll take the successful WaitEvent off our event list and put
-            // an ReapEvent there instead (which will contain the WaitEvent).
-            // First, put the WaitEvent inside a new unique_ptr.
-            unique_ptr<WaitEvent> waitEv(wait);
-            // Important! Release the old pointer so the WaitEvent doesn't get
-            // free'd when we replace the unique_ptr that currently holds it.
-            _events[i].release();
-            // Now replace with a ReapEvent that contains the WaitEvent
-            _events[i] = make_unique<ReapEvent>(
-                *this, std::move(waitEv), std::move(child));
+            // an ReapEvent there instead (which will contain the WaitEvent,
+            // and be the one to destroy it from now on).
+            _events[i] = _arena.make<ReapEvent>(*this, wait, child._id);
+            _update_event(_events[i]);
 
             log("{}", _events[i]->to_string()); // log updated event
             return;
         }
     }
     process_assert(false, "notify_reaped({}) couldn't find the initial wait "
-        "event that led to the reapage", child->to_string());
+        "event that led to the reapage", child.to_string());
+}
+
+void Process::notify_inferred_reap(Process& child)
+{
+    process_assert(child._state == State::ZOMBIE,
+        "notify_inferred_reap({}) called on non-zombie process", 
+        child.to_string());
+    child._state = State::REAPED;
+    _forget_child(child._id);
+
+    auto reap = _arena.make<ReapEvent>(*this, nullptr, child._id);
+    if (!dead())
+    {
+        _add_event(reap, true);
+        return;
+    }
+    _events.push_back(reap);
+    _update_event(reap);
+    log("{}", reap->to_string());
+    std::swap(_events[_events.size() - 2], _events.back());
 }
 
-void Process::notify_forked(shared_ptr<Process> child) 
+void Process::notify_forked(Process& child) 
 {
+    process_assert(&child._tree == &_tree, "notify_forked({}) called with a "
+        "child from another tree", child.to_string());
     // consumeLocation=true (forktrace.h updates source location for forks)
-    _add_event(make_unique<ForkEvent>(*this, std::move(child)), true);
+    _add_event(_arena.make<ForkEvent>(*this, child._id), true);
+    _children.push_back(child._id);
 }
 
-void Process::notify_exec(string file, vector<string> args, int errcode) 
+void Process::notify_exec(string file, vector<string> argv, int errcode) 
 {
+    Argv args(std::move(argv)); // so that we share it with anyone else
     if (_events.empty()) 
     {
         // We have no exec events so far - don't have to worry about merging
         // consumeLocation=true (forktrace.h updates source location for execs)
-        _add_event(make_unique<ExecEvent>(
-            *this, std::move(file), std::move(args), errcode), true);
+        _add_event(_arena.make<ExecEvent>(
+            *this, _arena.copy(file), args, errcode), true);
         return;
     }
 
-    auto event = dynamic_cast<ExecEvent*>(_events.back().get());
+    auto event = event_cast<ExecEvent>(_events.back());
 
     if (!event || event->succeeded() || event->args != args) 
     {
         // the last event wasn't a failed exec event, so don't merge
-        _add_event(make_unique<ExecEvent>(
-            *this, std::move(file), std::move(args), errcode), true);
+        _add_event(_arena.make<ExecEvent>(
+            *this, _arena.copy(file), args, errcode), true);
         return;
     }
 
@@ -201,8 +274,8 @@ void Process::notify_exec(string file, vector<string> args, int errcode)
         || event->args != args) 
     {
         // the last exec was for a different program or args - don't merge
-        _add_event(make_unique<ExecEvent>(
-            *this, std::move(file), std::move(args), errcode), true);
+        _add_event(_arena.make<ExecEvent>(
+            *this, _arena.copy(file), args, errcode), true);
         return;
     }
 
@@ -212,14 +285,15 @@ void Process::notify_exec(string file, vector<string> args, int errcode)
     // probably just the C library searching $PATH. (If that isn't the case,
     // then no biggie, since the user can still see the history of exec calls
     // if they want to). TODO make sure this feature is actually implemented.
-    event->calls.emplace_back(file, errcode); // update existing ExecEvent
+    event->calls.emplace_back(_arena.copy(file), errcode); // update the event
+    _update_event(event); // it might've succeeded this time
 
     // TODO maybe move printing of location into the event code itself? That
     // would clean some of this up.
     string str = event->call().to_string(*event);
-    if (event->location.has_value())
+    if (const SourceLocation* location = event->location())
     {
-        log("{} @ {}", str, event->location->to_string());
+        log("{} @ {}", str, location->to_string());
     }
     else
     {
@@ -233,9 +307,13 @@ void Process::notify_ended(int status)
     // this function if they have already checked this is the case.
     assert(WIFEXITED(status) || WIFSIGNALED(status));
 
+    if (_parent != NO_PROCESS)
+    {
+        _tree.get(_parent)._unreaped.push_back(_id);
+    }
     if (WIFEXITED(status)) 
     {
-        _add_event(make_unique<ExitEvent>(*this, WEXITSTATUS(status)));
+        _add_event(_arena.make<ExitEvent>(*this, WEXITSTATUS(status)));
         // Must set this *after* calling _add_event since it only allows events
         // to be added to processes that are State::ALIVE (good).
         _state = State::ZOMBIE;
@@ -247,11 +325,12 @@ void Process::notify_ended(int status)
         // promote the old one to being a killing signal. TODO lost info?
         if (!_events.empty()) 
         {
-            auto event = dynamic_cast<SignalEvent*>(_events.back().get());
+            auto event = event_cast<SignalEvent>(_events.back());
 
             if (event && event->signal == WTERMSIG(status))
             {
                 _killed = event->killed = true;
+                _update_event(event); // it isn't non-fatal anymore
                 log("{}", event->to_string());
                 _state = State::ZOMBIE;
                 return;
@@ -259,7 +338,7 @@ void Process::notify_ended(int status)
         }
 
         // killed=True since we know this signal ended the process.
-        _add_event(make_unique<SignalEvent>(*this, WTERMSIG(status), true));
+        _add_event(_arena.make<SignalEvent>(*this, WTERMSIG(status), true));
         _state = State::ZOMBIE; // must go after _add_event
         _killed = true;
     }
@@ -268,7 +347,7 @@ void Process::notify_ended(int status)
 void Process::notify_signaled(pid_t sender, int signal) 
 {
     // killed=False so far (we don't know if this signal killed yet)
-    _add_event(make_unique<SignalEvent>(*this, sender, signal, false));
+    _add_event(_arena.make<SignalEvent>(*this, sender, signal, false));
 }
 
 /* This is a static member function */
@@ -287,7 +366,8 @@ void Process::notify_sent_signal(pid_t killedId,
         // Both processes get a handle to the shared kill information. The 
         // source process consumes their source location (since forktrace.h
         // will update location when kill/tkill/tkill is called).
-        source._add_event(make_unique<KillEvent>(source, info, true), true);
+        source._add_event(
+            source._arena.make<KillEvent>(source, info, true), true);
 
         // Some signals like SIGKILL will kill the process instantly, so the 
         // death event will already be there. In that case, we want to put the 
@@ -297,15 +377,17 @@ void Process::notify_sent_signal(pid_t killedId,
         if (dest->dead())
         {
             assert(!dest->_events.empty());
-            unique_ptr<Event>& deathEvent = dest->_events.back();
             dest->_events.push_back(
-                make_unique<KillEvent>(*dest, std::move(info), false));
-            swap(deathEvent, dest->_events.back());
+                dest->_arena.make<KillEvent>(*dest, std::move(info), false));
+            dest->_update_event(dest->_events.back());
+            size_t last = dest->_events.size() - 1;
+            std::swap(dest->_events[last - 1], dest->_events[last]);
         } 
         else 
         {
             dest->_events.push_back(
-                make_unique<KillEvent>(*dest, move(info), false));
+                dest->_arena.make<KillEvent>(*dest, std::move(info), false));
+            dest->_update_event(dest->_events.back());
         }
     } 
     else 
@@ -313,21 +395,61 @@ void Process::notify_sent_signal(pid_t killedId,
         // We're not able to draw a clean line between two processes in the
         // tree, so we'll just use a RaiseEvent instead.
         source._add_event(
-            make_unique<RaiseEvent>(source, killedId, signal, toThread), true);
+            source._arena.make<RaiseEvent>(source, killedId, signal, toThread), 
+            true);
     }
 }
 
-void Process::notify_orphaned() 
+void Process::notify_orphaned(std::optional<ReapInfo> info) 
 {
     process_assert(_state == State::ZOMBIE, "notify_orphaned() called on "
         " a process that wasn't a ZOMBIE");
     _state = State::ORPHANED;
+    _reapInfo = std::move(info);
+    if (_parent != NO_PROCESS)
+    {
+        _tree.get(_parent)._forget_child(_id);
+    }
+}
+
+void Process::notify_detached()
+{
+    _add_event(_arena.make<DetachEvent>(*this));
+    _state = State::DETACHED; // must go after _add_event
+    if (_parent != NO_PROCESS)
+    {
+        _tree.get(_parent)._unreaped.push_back(_id);
+    }
+}
+
+void Process::notify_downgraded(size_t rate)
+{
+    _add_event(_arena.make<DowngradeEvent>(*this, rate));
+}
+
+int Process::next_visible_event(size_t start, uint8_t hidden) const
+{
+    if (_nextVisible.size() != _events.size() || _hidden != hidden)
+    {
+        _nextVisible.resize(_events.size());
+        _hidden = hidden;
+        int next = -1;
+        for (size_t i = _events.size(); i-- > 0; )
+        {
+            if ((_events[i]->visibility & hidden) == 0)
+            {
+                next = i;
+            }
+            _nextVisible[i] = next;
+        }
+    }
+    return start < _nextVisible.size() ? _nextVisible[start] : -1;
 }
 
 void Process::update_location(SourceLocation location) 
 {
     debug("{} got updated location {}", _pid, location.to_string());
-    _location.emplace(std::move(location));
+    _location = intern_location(std::move(location));
 }
 
 string Process::to_string() const 
@@ -352,6 +474,7 @@ string_view Process::state() const
         case State::ZOMBIE:     return "zombie";
         case State::REAPED:     return "reaped";
         case State::ORPHANED:   return "orphaned";
+        case State::DETACHED:   return "detached";
     }
     assert(!"Unreachable");
 }
@@ -360,17 +483,17 @@ string Process::command_line(int eventIndex) const
 {
     if (const ExecEvent* lastExec = _most_recent_exec(eventIndex))
     {
-        const vector<string>& args = lastExec->args;
-        return format("{} [ {} ]", lastExec->call().file, join(args));
+        return format("{} [ {} ]", lastExec->call().file, 
+            lastExec->args.joined());
     }
     else
     {
-        return format("{} [ {} ]", _initialName, join(_initialArgs));
+        return format("{} [ {} ]", _initialName, _initialArgs.joined());
     }
 }
 
 const Event& Process::death_event() const 
 {
     assert(dead() && !_events.empty());
-    return *_events.back().get();
+    return *_events.back();
 }
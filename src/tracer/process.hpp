@@ -8,12 +8,16 @@
 #define FORKTRACE_PROCESS_HPP
 
 #include <unistd.h>
+#include <deque>
 #include <vector>
 #include <memory>
 #include <string>
 #include <optional>
 
+#include "arena.hpp"
+#include "argv.hpp"
 #include "event.hpp"
+#include "system.hpp"
 
 /* This is thrown by the Process class whenever operation are done on the
  * process tree that don't make sense or aren't allowed. Why make this an
@@ -29,6 +33,8 @@ public:
     const char* what() const noexcept { return _msg.c_str(); }
 };
 
+class ProcessTree; // defined below
+
 /* Describes a process in a process tree. This class has public functions that
  * allow users to update it with certain events as they are occurring to the
  * process. We can then later examine the history of events when drawing. */
@@ -41,40 +47,73 @@ private:
         ZOMBIE,   // process is dead but hasn't been reaped yet
         REAPED,   // process is dead and was reaped by a parent
         ORPHANED, // process is dead and the reaper process had to reap it
+        DETACHED, // process was left out of the trace (it might be alive)
     };
 
     /* History */
+    ProcessTree& _tree; // the tree that owns us
+    ProcessId _id; // where we are in _tree
+    ProcessId _parent; // NO_PROCESS if we're the root (or weren't forked)
+    std::vector<ProcessId> _children; // in the order that they were forked
+    std::vector<ProcessId> _unreaped; // see unreaped_children
     pid_t _pid;
-    std::weak_ptr<Process> _parent;
-    std::vector<std::unique_ptr<Event>> _events;
+    Arena _arena; // our events (and their strings) are allocated out of this
+    std::vector<Event*> _events; // in _arena, and we destroy them
     std::string _initialName; // process's name before any additional execs
-    std::vector<std::string> _initialArgs; // ...similar thing here
+    Argv _initialArgs; // ...similar thing here (shared with everyone else)
 
     /* State */
     State _state;
     bool _killed; // have we been killed by the delivery of a signal?
-    std::optional<SourceLocation> _location; // current source location
+    LocationId _location; // current source location
+    std::optional<ReapInfo> _reapInfo; // if we were orphaned
+
+    /* A skip index for next_visible_event. _nextVisible[i] is the index of the
+     * first event at or after i without any of the _hidden flags (or -1). It's
+     * thrown away whenever the events change, and built again when needed. */
+    mutable std::vector<int> _nextVisible;
+    mutable uint8_t _hidden;
 
     /* Private functions, described in source file */
-    void _add_event(std::unique_ptr<Event> ev, bool consumeLoc = false);
+    void _add_event(Event* ev, bool consumeLoc = false);
+    void _update_event(Event* ev);
     const ExecEvent* _most_recent_exec(int startIndex = -1) const;
+    void _forget_child(ProcessId child);
 
 public:
-    /* Call this if the process has no (traced) parent and if we don't know its
-     * program arguments and name. */
-    Process(pid_t pid) : _pid(pid), _state(State::ALIVE), _killed(false) { }
+    /* Don't call these directly, use ProcessTree::add (which passes in the
+     * first two arguments). The rest of the arguments are described there. */
+    Process(ProcessTree& tree, ProcessId id, pid_t pid) 
+        : _tree(tree), _id(id), _parent(NO_PROCESS), _pid(pid), 
+        _state(State::ALIVE), _killed(false), _location(NO_LOCATION), 
+        _hidden(0) { }
+
+    Process(ProcessTree& tree, 
+            ProcessId id, 
+            pid_t pid, 
+            std::string_view name, 
+            std::vector<std::string> args)
+        : _tree(tree), _id(id), _parent(NO_PROCESS), _pid(pid), 
+        _initialName(name), _initialArgs(std::move(args)), 
+        _state(State::ALIVE), _killed(false), _location(NO_LOCATION), 
+        _hidden(0) { }
 
-    /* Call this if the process doesn't have a (traced) parent, but we do know
-     * its program arguments and name. */
-    Process(pid_t pid, std::string_view name, std::vector<std::string> args)
-        : _pid(pid), _initialName(name), _initialArgs(args), 
-        _state(State::ALIVE), _killed(false) { }
+    Process(ProcessTree& tree, ProcessId id, pid_t pid, Process& parent);
 
-    /* Call this if the process has a parent who forked/cloned us. */
-    Process(pid_t pid, const std::shared_ptr<Process>& parent);
+    Process(ProcessTree& tree, 
+            ProcessId id, 
+            pid_t pid, 
+            Process& parent,
+            std::string_view name, 
+            std::vector<std::string> args)
+        : _tree(tree), _id(id), _parent(parent._id), _pid(pid), 
+        _initialName(name), _initialArgs(std::move(args)), 
+        _state(State::ALIVE), _killed(false), _location(NO_LOCATION), 
+        _hidden(0) { }
 
     Process(const Process&) = delete;
     Process(Process&&) = delete;
+    ~Process();
 
     /* These functions notify the process tree of WaitEvents and ReapEvents.
      * They can only validly be called in the following possible sequences:
@@ -87,14 +126,24 @@ public:
      * the delivery of a signal). Throws ProcessTreeError if the process wasn't
      * previously notified via notify_waiting. The `waitedId` param below has 
      * the same meaning as the pid argument of waitpid(2) (incl. pids <= 0). 
-     * notify_reaped will throw an error if the child isn't a zombie. */
-    void notify_waiting(pid_t waitedId, bool nohang);
-    void notify_failed_wait(int error); // error could be 0 for nohang
-    void notify_reaped(std::shared_ptr<Process> child);
+     * notify_reaped will throw an error if the child isn't a zombie (or 
+     * detached, since we don't get to see those die). The `tid` is the thread
+     * that's doing the waiting (the pid unless we're multi-threaded), since 
+     * each thread could be in the middle of its own wait. */
+    void notify_waiting(pid_t waitedId, bool nohang, pid_t tid);
+    void notify_failed_wait(int error, pid_t tid); // error 0 for nohang
+    void notify_reaped(Process& child, pid_t tid);
+
+    /* Like notify_reaped, but for when we never saw the wait call, and only
+     * worked out afterwards that this process must have reaped the child (see
+     * Tracer::Options::lifecycle). The ReapEvent has no WaitEvent inside it.
+     * If this process has already ended, then it goes just before the death
+     * event (since it must have happened before that). */
+    void notify_inferred_reap(Process& child);
 
     /* Update the process tree with a fork event, with this process being the
-     * parent process. */
-    void notify_forked(std::shared_ptr<Process> child);
+     * parent process. The child has to be in the same tree. */
+    void notify_forked(Process& child);
 
     /* Update the process tree with an exec event (success or failure). err
      * should be an errno value (e.g., 0 for success, 1 for EPERM, etc.). This
@@ -129,8 +178,40 @@ public:
     /* Update the process tree with an orphan event. Indicates that the parent
      * of this process died without reaping it (and any sub-reaper processes
      * above it also died before reaping it). Throws a ProcessTreeError if
-     * called when the process isn't already a zombie. */
-    void notify_orphaned();
+     * called when the process isn't already a zombie. If whoever reaped the
+     * orphan told us more about it, then pass that along too. */
+    void notify_orphaned(std::optional<ReapInfo> info = std::nullopt);
+
+    /* Update the process tree with a DetachEvent. This is the last event that
+     * we'll see from this process (apart from its parent reaping it), since we
+     * aren't tracing it anymore. Counts as being dead as far as the tree goes
+     * (since nothing else will happen to it). */
+    void notify_detached();
+
+    /* Update the process tree with a DowngradeEvent, which means that only
+     * forks, execs and exits get recorded for this process from now on. */
+    void notify_downgraded(size_t rate);
+
+    /* Returns the index of the first event at or after `start` without any of
+     * the `hidden` flags (see Event::Visibility), or -1 if there isn't one.
+     * This is cheap if it keeps getting called with the same flags, since the
+     * answers are worked out all at once and cached until the events change.*/
+    int next_visible_event(size_t start, uint8_t hidden) const;
+
+    /* Returns true if this process has forked any children. */
+    bool has_children() const { return !_children.empty(); }
+
+    /* The ids of the children that this process has forked, in order. */
+    const std::vector<ProcessId>& children() const { return _children; }
+
+    /* The ids of the children that have ended (or been left out of the trace,
+     * see notify_detached), but that haven't been reaped or orphaned yet, in
+     * the order that that happened. These are the only ones that a wait could
+     * reap, so the tracer looks here instead of going through every child. */
+    const std::vector<ProcessId>& unreaped_children() const 
+    { 
+        return _unreaped; 
+    }
 
     /* Provide this Process with a source location update. This source location
      * will be stuck onto the next eligible event that this process receives,
@@ -170,12 +251,69 @@ public:
     bool reaped() const { return _state == State::REAPED; }
     bool dead() const { return _state != State::ALIVE; }
     bool orphaned() const { return _state == State::ORPHANED; }
+    bool detached() const { return _state == State::DETACHED; }
+    const std::optional<ReapInfo>& reap_info() const { return _reapInfo; }
     pid_t pid() const { return _pid; }
+    ProcessId id() const { return _id; }
+    ProcessTree& tree() const { return _tree; }
+    Process* parent() const; // null if we're the root
     size_t event_count() const { return _events.size(); }
 
     /* This returns a reference that could be invalidated if any non-const
      * member functions are called - otherwise, you'll be fine. */
-    const Event& event(size_t i) const { return *_events.at(i).get(); }
+    const Event& event(size_t i) const { return *_events.at(i); }
+};
+
+/* Owns all of the processes in a process tree. The processes are allocated in
+ * big chunks (a deque never moves what's already in it), and refer to each 
+ * other by their ProcessIds, which are just indexes into the tree. The root is
+ * always the first process added. Processes are never removed, so a reference
+ * to one of them is good for as long as the tree is around. */
+class ProcessTree
+{
+private:
+    std::deque<Process> _processes;
+
+public:
+    ProcessTree() { }
+    ProcessTree(const ProcessTree&) = delete;
+    ProcessTree(ProcessTree&&) = delete;
+
+    /* Creates a new process in the tree, and returns it. The arguments can be
+     * any of the following:
+     *
+     *  (pid)               no (traced) parent, and we don't know its program
+     *                      arguments or name.
+     *  (pid, name, args)   no (traced) parent, but we do know its program 
+     *                      arguments and name.
+     *  (pid, parent)       it was forked/cloned by `parent` (which has to be
+     *                      in this tree).
+     *  (pid, parent, name, args)
+     *                      it has a (traced) parent, but it was forked before
+     *                      we were tracing it (see Tracer::attach), so we know
+     *                      its program arguments and name but not where they
+     *                      came from.
+     */
+    template<typename ...Args>
+    Process& add(Args&&... args)
+    {
+        ProcessId id = _processes.size();
+        return _processes.emplace_back(*this, id, std::forward<Args>(args)...);
+    }
+
+    Process& get(ProcessId id) { return _processes.at(id); }
+    const Process& get(ProcessId id) const { return _processes.at(id); }
+
+    /* The tree mustn't be empty. */
+    Process& root() { return _processes.front(); }
+    const Process& root() const { return _processes.front(); }
+
+    size_t size() const { return _processes.size(); }
 };
 
+inline Process* Process::parent() const
+{
+    return _parent == NO_PROCESS ? nullptr : &_tree.get(_parent);
+}
+
 #endif /* FORKTRACE_PROCESS_HPP */
@@ -8,19 +8,30 @@
  *      The functions that manipulate memory in the tracee just use ptrace's
  *      PTRACE_PEEKDATA and PTRACE_POKEDATA options although there are nicer
  *      (more complicated) methods that would avoid as much context switching.
+ *      See memory.hpp for those (which fall back to these when they can't).
  */
 #include <cassert> // TODO don't need
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 #include <sys/reg.h>
 #include <sys/user.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 
 #include "ptrace.hpp"
 #include "system.hpp"
+#include "stats.hpp"
 
 using std::string;
 using std::string_view;
@@ -49,28 +60,35 @@ constexpr int PTRACER_OPTIONS = PTRACE_O_EXITKILL
                                 | PTRACE_O_TRACESYSGOOD
                                 | PTRACE_O_TRACEEXEC
                                 | PTRACE_O_TRACEFORK
-                                | PTRACE_O_TRACECLONE;
-
-bool get_syscall_ret(pid_t pid, size_t& retval) 
-{
-    errno = 0;
-    unsigned long val = ptrace(PTRACE_PEEKUSER, pid, 8 * RAX, 0);
-    if (errno == ESRCH) 
-    {
-        return false;
-    }
-    if (errno != 0) 
-    {
-        throw SystemError(errno, "ptrace(PTRACE_PEEKUSER)");
-    }
-    retval = val;
-    return true;
-}
+                                | PTRACE_O_TRACEVFORK
+                                | PTRACE_O_TRACECLONE
+                                | PTRACE_O_TRACESECCOMP;
+
+/* The syscalls that the seccomp filter will stop the tracee for. This has to
+ * be kept in sync with what Tracer::_handle_syscall_entry cares about (any
+ * syscall that it doesn't just resume straight away should be in here). */
+static const int FILTERED_SYSCALLS[] = {
+    SYSCALL_CLONE,
+    SYSCALL_CLONE3,
+    SYSCALL_FORK,
+    SYSCALL_VFORK,
+    SYSCALL_EXECVE,
+    SYSCALL_EXECVEAT,
+    SYSCALL_WAIT4,
+    SYSCALL_WAITID,
+    SYSCALL_KILL,
+    SYSCALL_TKILL,
+    SYSCALL_TGKILL,
+    SYSCALL_PTRACE,
+    SYSCALL_SETPGID,
+    SYSCALL_SETSID,
+    SYSCALL_FAKE,
+};
 
 bool set_syscall(pid_t pid, int syscall)
 {
     void* addr = (void*)(8 * ORIG_RAX);
-    if (ptrace(PTRACE_POKEUSER, pid, addr, (void*)(size_t)syscall) == -1) 
+    if (PTRACE(PTRACE_POKEUSER, pid, addr, (void*)(size_t)syscall) == -1) 
     {
         if (errno == ESRCH) 
         {
@@ -81,77 +99,108 @@ bool set_syscall(pid_t pid, int syscall)
     return true;
 }
 
-bool which_syscall(pid_t pid, int& syscall, size_t args[SYS_ARG_MAX]) 
+/* Set to false if the kernel doesn't know about PTRACE_GET_SYSCALL_INFO. */
+static bool syscallInfoWorks = true;
+
+bool get_syscall_stop(pid_t pid, SyscallStop::Op expected, SyscallStop& stop)
 {
-    struct user_regs_struct regs;
-    if (ptrace(PTRACE_GETREGS, pid, 0, (void*)&regs) == -1) 
+    if (syscallInfoWorks)
     {
+        struct __ptrace_syscall_info info;
+        if (PTRACE(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) != -1)
+        {
+            switch (info.op)
+            {
+                case PTRACE_SYSCALL_INFO_ENTRY:
+                    stop.op = SyscallStop::ENTRY;
+                    stop.syscall = info.entry.nr;
+                    std::copy(info.entry.args, info.entry.args + SYS_ARG_MAX,
+                              stop.args);
+                    break;
+                case PTRACE_SYSCALL_INFO_SECCOMP:
+                    stop.op = SyscallStop::SECCOMP;
+                    stop.syscall = info.seccomp.nr;
+                    std::copy(info.seccomp.args, 
+                              info.seccomp.args + SYS_ARG_MAX, stop.args);
+                    break;
+                case PTRACE_SYSCALL_INFO_EXIT:
+                    stop.op = SyscallStop::EXIT;
+                    stop.retval = info.exit.rval;
+                    break;
+                default:
+                    stop.op = SyscallStop::NONE;
+                    break;
+            }
+            return true;
+        }
         if (errno == ESRCH) 
         {
             return false;
         }
-        throw SystemError(errno, "ptrace(PTRACE_GETREGS)");
-    }
-    syscall = regs.orig_rax;
-    if (args != nullptr) 
-    {
-        args[0] = regs.rdi;
-        args[1] = regs.rsi;
-        args[2] = regs.rdx;
-        args[3] = regs.r10;
-        args[4] = regs.r8;
-        args[5] = regs.r9;
-    }
-    return true;
-}
-
-bool set_syscall_arg(pid_t pid, size_t val, int argIndex) 
-{
-    const size_t addrs[6] = {
-        8 * RDI,
-        8 * RSI,
-        8 * RDX,
-        8 * R10,
-        8 * R8,
-        8 * R9,
-    };
-
-    if (argIndex < 0 || argIndex >= 6) 
-    {
-        assert(!"Not implemented.");
+        if (errno != EIO)
+        {
+            throw SystemError(errno, "ptrace(PTRACE_GET_SYSCALL_INFO)");
+        }
+        // EIO means that the kernel didn't recognise the request.
+        syscallInfoWorks = false;
     }
 
-    void* addr = (void*)addrs[argIndex];
-    if (ptrace(PTRACE_POKEUSER, pid, addr, (void*)val) == -1) 
+    // The registers have everything else we need, so just grab them all.
+    struct user_regs_struct regs;
+    if (PTRACE(PTRACE_GETREGS, pid, 0, (void*)&regs) == -1) 
     {
         if (errno == ESRCH) 
         {
             return false;
         }
-        throw SystemError(errno, "ptrace(PTRACE_POKEUSER)");
+        throw SystemError(errno, "ptrace(PTRACE_GETREGS)");
     }
+    stop.op = expected;
+    stop.syscall = regs.orig_rax;
+    stop.args[0] = regs.rdi;
+    stop.args[1] = regs.rsi;
+    stop.args[2] = regs.rdx;
+    stop.args[3] = regs.r10;
+    stop.args[4] = regs.r8;
+    stop.args[5] = regs.r9;
+    stop.retval = regs.rax;
     return true;
 }
 
-bool get_tracee_result_addr(pid_t pid, void*& result) 
+/* Builds the BPF program for the seccomp filter described in ptrace.hpp. It's
+ * just a linear list of comparisons against the syscall number - there's only
+ * about a dozen of them, so it's not worth doing anything fancier. Syscalls
+ * from any other architecture (e.g., int 0x80) are always traced, since that
+ * is what would happen without the filter anyway. The same goes for x32
+ * syscalls, which run under AUDIT_ARCH_X86_64 but have __X32_SYSCALL_BIT set
+ * in their number (so they'd never match any of the comparisons below). */
+static vector<sock_filter> build_seccomp_filter()
 {
-    // the stack pointer is a reasonable guess, as long as we aren't reading or
-    // writing too much. To give ourselves even more margin we could round the
-    // address down to the beginning of the page. I suppose if you wanted to be
-    // more thorough, you could look at the memory map for the tracee or map
-    // your own pages into the tracee's address space for this purpose...
-    errno = 0;
-    size_t addr = ptrace(PTRACE_PEEKUSER, pid, 8 * RBP, 0); 
-    result = (void*)(addr & ~(SYS_PAGE_SIZE - 1));
-    if (errno == ESRCH) 
-    {
-        return false;
-    }
-    if (errno != 0) 
-    {
-        throw SystemError(errno, "ptrace(PTRACE_PEEKUSER)");
-    }
-    return true;
+    vector<sock_filter> prog;
+    prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 
+        offsetof(seccomp_data, arch)));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 
+        AUDIT_ARCH_X86_64, 1, 0));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+    prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 
+        offsetof(seccomp_data, nr)));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 
+        (uint32_t)__X32_SYSCALL_BIT, 0, 1));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+    for (int syscall : FILTERED_SYSCALLS)
+    {
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 
+            (uint32_t)syscall, 0, 1));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+    }
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+    return prog;
+}
+
+bool seccomp_supported()
+{
+    uint32_t action = SECCOMP_RET_TRACE;
+    return syscall(SYS_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action) == 0;
 }
 
 /* Helper function for setup_child and start. This is how the child
@@ -186,15 +235,18 @@ static int exit_status_to_errno(int exitStatus)
     }
 }
 
-/* Helper function for start() to exec the traced child process. */
-static void setup_child(string_view program, vector<string> argv)
+/* Helper function for start() to exec the traced child process. If `filter`
+ * isn't null, then it is installed as a seccomp filter right before exec. */
+static void setup_child(string_view program, 
+                        vector<string> argv, 
+                        const sock_fprog* filter)
 {
     // don't want children to inherit our blocked signals
     sigset_t set;
     sigfillset(&set);
     pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
 
-    if (ptrace(PTRACE_TRACEME, 0, 0, 0) == -1)
+    if (PTRACE(PTRACE_TRACEME, 0, 0, 0) == -1)
     {
         _exit(errno_to_exit_status(errno));
     }
@@ -210,6 +262,19 @@ static void setup_child(string_view program, vector<string> argv)
     // sync up with tracer
     raise(SIGSTOP);
 
+    // This has to happen after the tracer has set PTRACE_O_TRACESECCOMP (which
+    // it does after the previous SIGSTOP), otherwise all the filtered syscalls
+    // would just fail with ENOSYS. If this fails, the tracer will find out as
+    // soon as it sees that we exited before we could exec.
+    if (filter)
+    {
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1
+            || syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, filter) == -1)
+        {
+            _exit(errno_to_exit_status(errno));
+        }
+    }
+
     // Convert args to a format that exec will like
     vector<const char*> args;
     for (auto& arg : argv)
@@ -268,8 +333,18 @@ static void throw_failed_start(pid_t pid, int status, string_view name)
     throw runtime_error("Unexpected change of state by tracee.");
 }
 
-pid_t start_tracee(string_view program, vector<string> argv)
+pid_t start_tracee(string_view program, vector<string> argv, bool seccomp)
 {
+    // Build this before we fork so that the child doesn't have to allocate
+    vector<sock_filter> prog;
+    sock_fprog filter = {};
+    if (seccomp)
+    {
+        prog = build_seccomp_filter();
+        filter.len = prog.size();
+        filter.filter = prog.data();
+    }
+
     pid_t pid = fork();
     if (pid < 0)
     {
@@ -277,7 +352,7 @@ pid_t start_tracee(string_view program, vector<string> argv)
     }
     if (pid == 0)
     {
-        setup_child(program, std::move(argv));
+        setup_child(program, std::move(argv), seccomp ? &filter : nullptr);
         /* NOTREACHED */
     }
 
@@ -293,7 +368,7 @@ pid_t start_tracee(string_view program, vector<string> argv)
         throw_failed_start(pid, status, "ptrace(PTRACE_TRACEME)"); // will reap
         /* NOTREACHED */
     }
-    if (ptrace(PTRACE_CONT, pid, 0, 0) == -1)
+    if (PTRACE(PTRACE_CONT, pid, 0, 0) == -1)
     {
         kill_and_reap(pid); // preserves errno for us
         throw SystemError(errno, "ptrace(PTRACE_CONT)");
@@ -311,7 +386,7 @@ pid_t start_tracee(string_view program, vector<string> argv)
         throw_failed_start(pid, status, "setpgid"); // reaps for us
         /* NOTREACHED */
     }
-    if (ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACER_OPTIONS) == -1)
+    if (PTRACE(PTRACE_SETOPTIONS, pid, 0, PTRACER_OPTIONS) == -1)
     {
         kill_and_reap(pid); // preserves errno
         throw SystemError(errno, "ptrace(PTRACE_SETOPTIONS)");
@@ -320,70 +395,249 @@ pid_t start_tracee(string_view program, vector<string> argv)
     return pid;
 }
 
-bool resume_tracee(pid_t pid, int signal)
+bool resume_tracee(pid_t pid, int signal, bool syscallStop)
 {
     // Tell ptracee to resume until it reaches a syscall-stop or other stop.
     // If we have a pending signal to deliver, we'll do that now too.
-    if (ptrace(PTRACE_SYSCALL, pid, 0, signal) == -1)
+    auto request = syscallStop ? PTRACE_SYSCALL : PTRACE_CONT;
+    if (PTRACE(request, pid, 0, signal) == -1)
     {
         if (errno == ESRCH)
         {
             return false;
         }
-        throw SystemError(errno, "ptrace(PTRACE_SYSCALL)");
+        throw SystemError(errno, syscallStop 
+            ? "ptrace(PTRACE_SYSCALL)" : "ptrace(PTRACE_CONT)");
     }
     return true;
 }
 
-bool memset_tracee(pid_t pid, void* dest, uint8_t value, size_t len)
+bool detach_tracee(pid_t pid)
 {
-    // TODO alignment?
-    int i = 0; // index of current word
-    size_t* curAddr = (size_t*)dest;
-    int numWords = ALIGNED_ROUND_DOWN(len) / sizeof(size_t);
-    int remainder = len % sizeof(size_t);
-    void* valueWord;
-    memset(&valueWord, value, sizeof(valueWord));
+    if (PTRACE(PTRACE_DETACH, pid, 0, 0) == -1)
+    {
+        if (errno == ESRCH)
+        {
+            return false;
+        }
+        throw SystemError(errno, "ptrace(PTRACE_DETACH)");
+    }
+    return true;
+}
 
-    for (; i < numWords; ++curAddr, ++i) 
+bool attach_tracee(pid_t tid)
+{
+    if (PTRACE(PTRACE_SEIZE, tid, 0, PTRACE_O_TRACESYSGOOD) == -1)
     {
-        if (ptrace(PTRACE_POKEDATA, pid, curAddr, valueWord) == -1) 
+        if (errno == ESRCH)
         {
-            if (errno == ESRCH) 
-            {
-                return false;
-            }
-            throw SystemError(errno, "ptrace(PTRACE_POKEDATA)");
+            return false;
         }
+        throw SystemError(errno, "ptrace(PTRACE_SEIZE)");
     }
-    if (remainder != 0) 
+    // If this fails with ESRCH, then it's on its way out, and its exit status
+    // will turn up anyway (since we're tracing it now).
+    if (PTRACE(PTRACE_INTERRUPT, tid, 0, 0) == -1 && errno != ESRCH)
     {
-        // Since we can only write multiples of the word size, we first need to
-        // copy this word from the tracee, then change just the bytes that we
-        // need, then we need to copy the word back to the tracee.
-        errno = 0;
-        size_t word = ptrace(PTRACE_PEEKDATA, pid, curAddr, 0);
-        if (errno == ESRCH) 
+        throw SystemError(errno, "ptrace(PTRACE_INTERRUPT)");
+    }
+    return true;
+}
+
+bool finish_attaching(pid_t tid)
+{
+    int options = PTRACER_OPTIONS & ~PTRACE_O_EXITKILL;
+    if (PTRACE(PTRACE_SETOPTIONS, tid, 0, options) == -1)
+    {
+        if (errno == ESRCH)
         {
             return false;
         }
-        if (errno != 0) 
+        throw SystemError(errno, "ptrace(PTRACE_SETOPTIONS)");
+    }
+    return true;
+}
+
+/* Reads all of a file in /proc. Returns false if it doesn't exist (which is
+ * what happens once the process is gone). Throws SystemError on failure. */
+static bool read_proc_file(const string& path, string& result)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno == ENOENT || errno == ESRCH)
         {
-            throw SystemError(errno, "ptrace(PTRACE_PEEKDATA)");
+            return false;
+        }
+        throw SystemError(errno, "open(" + path + ")");
+    }
+    char buf[4096];
+    ssize_t len;
+    result.clear();
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        result.append(buf, len);
+    }
+    int err = errno;
+    close(fd);
+    if (len == -1)
+    {
+        if (err == ESRCH)
+        {
+            return false;
         }
+        throw SystemError(err, "read(" + path + ")");
+    }
+    return true;
+}
 
-        memcpy(&word, &valueWord, remainder);
+bool get_threads(pid_t pid, vector<pid_t>& tids)
+{
+    string path = "/proc/" + std::to_string(pid) + "/task";
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        if (errno == ENOENT || errno == ESRCH)
+        {
+            return false;
+        }
+        throw SystemError(errno, "opendir(/proc/<pid>/task)");
+    }
+    tids.clear();
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            tids.push_back(strtol(entry->d_name, nullptr, 10));
+        }
+    }
+    closedir(dir);
+    return true;
+}
 
-        // Now write that word back.
-        if (ptrace(PTRACE_POKEDATA, pid, curAddr, (void*)word) == -1) 
+bool get_children(pid_t pid, pid_t tid, vector<pid_t>& children)
+{
+    string path = "/proc/" + std::to_string(pid) + "/task/" 
+        + std::to_string(tid) + "/children";
+    string contents;
+    if (!read_proc_file(path, contents))
+    {
+        return false;
+    }
+    children.clear();
+    const char* cur = contents.c_str(); // space-separated PIDs
+    while (true)
+    {
+        char* end;
+        long child = strtol(cur, &end, 10);
+        if (end == cur)
         {
-            if (errno == ESRCH) 
-            {
-                return false;
-            }
-            throw SystemError(errno, "ptrace(PTRACE_POKEDATA)");
+            return true;
+        }
+        children.push_back(child);
+        cur = end;
+    }
+}
+
+bool get_cmdline(pid_t pid, vector<string>& args)
+{
+    string contents;
+    if (!read_proc_file("/proc/" + std::to_string(pid) + "/cmdline", contents))
+    {
+        return false;
+    }
+    args.clear();
+    for (size_t start = 0; start < contents.size(); )
+    {
+        size_t end = contents.find('\0', start);
+        if (end == string::npos)
+        {
+            end = contents.size();
+        }
+        args.push_back(contents.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+bool get_tgid(pid_t tid, pid_t& tgid)
+{
+    string contents;
+    if (!read_proc_file("/proc/" + std::to_string(tid) + "/status", contents))
+    {
+        return false;
+    }
+    size_t line = contents.find("\nTgid:");
+    if (line == string::npos)
+    {
+        throw runtime_error("Couldn't parse /proc/<pid>/status.");
+    }
+    tgid = strtol(contents.c_str() + line + strlen("\nTgid:"), nullptr, 10);
+    return true;
+}
+
+/* Reads /proc/<pid>/stat into `buf` and returns a pointer to its third field
+ * (the state), or nullptr if the process doesn't exist. The file looks like
+ * "<pid> (<name>) <state> ...", but the name could contain brackets and spaces,
+ * so we look for the last closing bracket. Throws SystemError on failure. */
+static const char* read_stat(pid_t pid, char (&buf)[1024])
+{
+    string path = "/proc/" + std::to_string(pid) + "/stat";
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno == ENOENT || errno == ESRCH)
+        {
+            return nullptr;
+        }
+        throw SystemError(errno, "open(/proc/<pid>/stat)");
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    int err = errno;
+    close(fd);
+    if (len == -1)
+    {
+        if (err == ESRCH)
+        {
+            return nullptr; // it got reaped after we opened it
+        }
+        throw SystemError(err, "read(/proc/<pid>/stat)");
+    }
+    buf[len] = '\0';
+    char* end = strrchr(buf, ')');
+    if (!end || end[1] != ' ')
+    {
+        throw runtime_error("Couldn't parse /proc/<pid>/stat.");
+    }
+    return end + 2;
+}
+
+bool is_zombie(pid_t pid)
+{
+    char buf[1024];
+    const char* state = read_stat(pid, buf);
+    return state && *state == 'Z';
+}
+
+bool get_start_time(pid_t pid, unsigned long long& startTime)
+{
+    char buf[1024];
+    const char* field = read_stat(pid, buf);
+    if (!field)
+    {
+        return false;
+    }
+    // We're at field 3 (the state), and we want field 22.
+    for (int i = 3; i < 22; ++i)
+    {
+        field = strchr(field, ' ');
+        if (!field)
+        {
+            throw runtime_error("Couldn't parse /proc/<pid>/stat.");
         }
+        field++;
     }
+    startTime = strtoull(field, nullptr, 10);
     return true;
 }
 
@@ -400,7 +654,7 @@ bool copy_from_tracee(pid_t pid, void* dest, void* src, size_t len)
     for (;;) 
     {
         errno = 0;
-        word = ptrace(PTRACE_PEEKDATA, pid, curAddr, 0);
+        word = PTRACE(PTRACE_PEEKDATA, pid, curAddr, 0);
         if (errno == ESRCH) 
         {
             return false;
@@ -435,7 +689,7 @@ bool copy_to_tracee(pid_t pid, void* dest, void* src, size_t len)
     // Copy as many full words as we can
     for (; i < numWords; ++curAddr, ++i) 
     {
-        if (ptrace(PTRACE_POKEDATA, pid, curAddr, (void*)words[i]) == -1) 
+        if (PTRACE(PTRACE_POKEDATA, pid, curAddr, (void*)words[i]) == -1) 
         {
             if (errno == ESRCH) 
             {
@@ -450,7 +704,7 @@ bool copy_to_tracee(pid_t pid, void* dest, void* src, size_t len)
         // copy this word from the tracee, then change just the bytes that we
         // need, then we need to copy the word back to the tracee.
         errno = 0;
-        size_t word = ptrace(PTRACE_PEEKDATA, pid, curAddr, 0);
+        size_t word = PTRACE(PTRACE_PEEKDATA, pid, curAddr, 0);
         if (errno == ESRCH) 
         {
             return false;
@@ -463,7 +717,7 @@ bool copy_to_tracee(pid_t pid, void* dest, void* src, size_t len)
         memcpy(&word, &words[i], remainder);
 
         // Now write that word back.
-        if (ptrace(PTRACE_POKEDATA, pid, curAddr, (void*)word) == -1) 
+        if (PTRACE(PTRACE_POKEDATA, pid, curAddr, (void*)word) == -1) 
         {
             if (errno == ESRCH) 
             {
@@ -488,7 +742,7 @@ bool copy_string_from_tracee(pid_t pid,
     for (;;) 
     {
         errno = 0;
-        size_t word = ptrace(PTRACE_PEEKDATA, pid, (void*)curAddr, 0);
+        size_t word = PTRACE(PTRACE_PEEKDATA, pid, (void*)curAddr, 0);
         if (errno == ESRCH) 
         {
             return false;
@@ -518,7 +772,7 @@ bool copy_string_array_from_tracee(pid_t pid,
     for (;;) 
     {
         errno = 0;
-        long result = ptrace(PTRACE_PEEKDATA, pid, &argv[args.size()], 0);
+        long result = PTRACE(PTRACE_PEEKDATA, pid, &argv[args.size()], 0);
         if (errno == ESRCH) 
         {
             return false;
@@ -10,8 +10,10 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/ptrace.h>
 
 #include "system.hpp"
@@ -23,21 +25,51 @@
  */
 #define IS_EVENT(status, event) (((status) >> 8) == (SIGTRAP | ((event) << 8)))
 #define IS_FORK_EVENT(status) IS_EVENT(status, PTRACE_EVENT_FORK)
+#define IS_VFORK_EVENT(status) IS_EVENT(status, PTRACE_EVENT_VFORK)
 #define IS_EXEC_EVENT(status) IS_EVENT(status, PTRACE_EVENT_EXEC)
 #define IS_CLONE_EVENT(status) IS_EVENT(status, PTRACE_EVENT_CLONE)
 #define IS_EXIT_EVENT(status) IS_EVENT(status, PTRACE_EVENT_EXIT)
+#define IS_SECCOMP_EVENT(status) IS_EVENT(status, PTRACE_EVENT_SECCOMP)
 #define IS_SYSCALL_EVENT(status) (WSTOPSIG(status) == (SIGTRAP | 0x80))
 
+/* Tracees attached with PTRACE_SEIZE (see attach_tracee), and the children that
+ * they fork, report group-stops (and their initial stop) this way instead. The
+ * stop signal is still in WSTOPSIG(status) - it's SIGTRAP if there isn't one.*/
+#define IS_STOP_EVENT(status) (((status) >> 16) == PTRACE_EVENT_STOP)
+
 /* Modern libc implementations do not directly call the fork system call since
  * it is obselete. Instead, the more modern and flexible `clone` system call is
  * called instead (which is also used to create new threads). We need to figure
- * out if the clone call is equivalent to a fork.
+ * out if the clone call is equivalent to a fork. These get the flags and the
+ * signal that the child sends its parent when it dies (SIGCHLD for a fork).
  *
  * According to the Linux kernel source (kernel/fork.c), the `flags` argument
  * to clone (which is what we're interested in) *might* not be the first, so
  * hypothetically this *may* need to be changed when porting (probably not).
+ * (clone3 has them in a struct instead - see Clone3Args below).
  */
-#define IS_CLONE_LIKE_A_FORK(args) (((args)[0] & 0xFF) == SIGCHLD)
+#define GET_CLONE_FLAGS(args) ((args)[0])
+#define GET_CLONE_EXIT_SIGNAL(args) ((int)((args)[0] & CSIGNAL))
+
+/* Does a set of clone flags (see above) create a new thread in the caller's
+ * thread group instead of a new process? This is what pthread_create does. */
+#define IS_CLONE_A_THREAD(flags) (((flags) & CLONE_THREAD) != 0)
+
+/* Does a set of clone flags suspend the parent until the child execs or exits
+ * (like vfork does)? This is what posix_spawn does. */
+#define IS_CLONE_A_VFORK(flags) (((flags) & CLONE_VFORK) != 0)
+
+/* The start of the `struct clone_args` that clone3 takes a pointer to (as its
+ * first argument). It's newer than our libc headers, and all we need are the
+ * first few fields anyway. See clone(2). */
+struct Clone3Args
+{
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t childTid;
+    uint64_t parentTid;
+    uint64_t exitSignal;
+};
 
 /* Starts a tracee using the specified program and argments. Will throw
  * SystemError if a syscall failed or runtime_error if something weird 
@@ -48,23 +80,88 @@
  *
  *      - PTRACE_O_EXITKILL: If we end, then the tracee gets SIGKILL'ed.
  *      - PTRACE_O_TRACEFORK: Automatically trace forked children.
+ *      - PTRACE_O_TRACEVFORK: Automatically trace vforked children.
  *      - PTRACE_O_TRACEEXEC: Automatically stop at the next successful exec.
  *      - PTRACE_O_TRACECLONE: Automatically trace cloned children.
  *      - PTRACE_O_TRACESYSGOOD: Helps disambiguate syscalls from other events.
+ *      - PTRACE_O_TRACESECCOMP: Stop when the seccomp filter says to trace.
+ *
+ * If `seccomp` is true, then the child installs a seccomp filter (which gets
+ * inherited by all of its descendants) before it execs. This filter causes a
+ * PTRACE_EVENT_SECCOMP stop on entry to the syscalls that the tracer cares
+ * about (forks, execs, waits, kills, our fake syscall and the banned ones), 
+ * so the tracee can be resumed with PTRACE_CONT instead of PTRACE_SYSCALL and
+ * every other syscall runs without stopping. Installing the filter requires
+ * PR_SET_NO_NEW_PRIVS (which a ptrace'd process can't make use of anyway).
  *
  * Also prevents the child from inheriting any of our blocked signals. */
-pid_t start_tracee(std::string_view program, std::vector<std::string> argv);
+pid_t start_tracee(std::string_view program, 
+                   std::vector<std::string> argv,
+                   bool seccomp = false);
+
+/* Returns true if this kernel supports the seccomp filter used by start_tracee
+ * (i.e., seccomp filters are enabled and SECCOMP_RET_TRACE is available). */
+bool seccomp_supported();
 
 /* Resumes the traced process. Throws SystemError on failure (which will
  * include if the tracee is not currently stopped). If the tracee could not
  * be found, then false is returned (i.e., ptrace gave ESRCH). If signal != 0,
- * then the specified signal will be delivered to the process when resumed. */
-bool resume_tracee(pid_t pid, int signal = 0);
-
-/* Sets a block of memory within the tracee's memory space. Will throw
- * a SystemError on failure (which could be EIO if the address is bad).
- * Returns false if the tracee does not exist anymore. */
-bool memset_tracee(pid_t tracee, void* dest, uint8_t value, size_t len);
+ * then the specified signal will be delivered to the process when resumed.
+ * If syscallStop is true, then the tracee is resumed with PTRACE_SYSCALL (so
+ * it will stop at the next syscall entry/exit), otherwise PTRACE_CONT is used
+ * (so it will only stop for signals, ptrace events and seccomp stops). */
+bool resume_tracee(pid_t pid, int signal = 0, bool syscallStop = true);
+
+/* Starts tracing a thread of a process that we didn't start (see Tracer::
+ * attach) with PTRACE_SEIZE, and then interrupts it with PTRACE_INTERRUPT so
+ * that it reports a PTRACE_EVENT_STOP (see IS_STOP_EVENT) - unless some other
+ * stop beats it to it. None of our usual options are set yet, so it can't fork
+ * anything onto us before we've caught up with it (see finish_attaching).
+ * Returns false if the thread doesn't exist anymore. Throws SystemError on any
+ * other failure (e.g., EPERM if we aren't allowed to trace it). */
+bool attach_tracee(pid_t tid);
+
+/* Once a thread that we attached to has stopped, this sets the same options 
+ * that start_tracee uses, except for PTRACE_O_EXITKILL (since we don't want to
+ * take it down with us), and there's no seccomp filter of course. Returns false
+ * if the thread doesn't exist anymore. Throws SystemError on failure. */
+bool finish_attaching(pid_t tid);
+
+/* Stops tracing a tracee for good and lets it carry on (throwing away whatever
+ * signal it's in the middle of delivering - e.g., the SIGSTOP that new children
+ * start with). The tracee must be in a ptrace-stop, and mustn't have our
+ * seccomp filter (or else the syscalls that it filters would just fail with
+ * ENOSYS once nobody's tracing it). Returns false if the tracee doesn't exist
+ * anymore and throws SystemError on any other failure. */
+bool detach_tracee(pid_t pid);
+
+/* Returns true if the process is currently a zombie (i.e., it has ended but
+ * nobody has reaped it yet), according to /proc/<pid>/stat. Returns false if 
+ * it isn't, or if it doesn't exist at all. Throws SystemError on failure. */
+bool is_zombie(pid_t pid);
+
+/* Gets the time that the process started at (in clock ticks since boot) from
+ * /proc/<pid>/stat. PIDs get recycled, but the PID and the start time together
+ * identify a process. Returns false if the process doesn't exist, and throws
+ * SystemError on failure. */
+bool get_start_time(pid_t pid, unsigned long long& startTime);
+
+/* Lists the IDs of the threads in a process (from /proc/<pid>/task), or the
+ * children of one of its threads (from /proc/<pid>/task/<tid>/children). The
+ * lists are in no particular order and could change at any moment unless all
+ * the threads are stopped. Returns false if the process doesn't exist. Throws
+ * SystemError on failure. */
+bool get_threads(pid_t pid, std::vector<pid_t>& tids);
+bool get_children(pid_t pid, pid_t tid, std::vector<pid_t>& children);
+
+/* Gets the program arguments of a process from /proc/<pid>/cmdline. Returns
+ * false if the process doesn't exist. Throws SystemError on failure. */
+bool get_cmdline(pid_t pid, std::vector<std::string>& args);
+
+/* Gets the ID of the thread group that a thread belongs to, from the Tgid line
+ * of /proc/<tid>/status. Returns false if the thread doesn't exist. Throws
+ * SystemError on failure. */
+bool get_tgid(pid_t tid, pid_t& tgid);
 
 /* Copies a block of memory from the tracee's address space to our address
  * space. Throws a SystemError on failure (EIO if region is bad). Returns
@@ -91,29 +188,35 @@ bool copy_string_array_from_tracee(pid_t tracee,
                                    const char** traceeAddr, 
                                    std::vector<std::string>& result);
 
-/* Find somewhere in the tracee's memory space that we can use to store the
- * result of a syscall (when the tracee didn't want a result themselves).
- * Throws SystemError on failure or returns false if the tracee couldn't
- * be found (e.g., ESRCH from ptrace). */
-bool get_tracee_result_addr(pid_t pid, void*& result);
-
-/* Modify the registers of the tracee to change the value of a syscall arg.
- * This should only be done when in a syscall-entry-stop. Throws SystemError
- * on failure or returns false if the tracee couldn't be found. */
-bool set_syscall_arg(pid_t pid, size_t val, int argIndex);
-
 /* Modify the registers of the tracee to change the syscall number that will
  * be called. This should only be done when in a syscall-entry-stop. Throws 
  * SystemError on failure or returns false if the tracee couldn't be found. */
 bool set_syscall(pid_t pid, int syscall);
 
-/* Find out the syscall number and arguments (we must be in a syscall-entry-
- * stop for this to work and make sense). Throws SystemError on false or
- * returns false if the tracee couldn't be found. */
-bool which_syscall(pid_t pid, int& syscall, size_t args[SYS_ARG_MAX]); 
-
-/* Get the return value of the syscall when in a syscall-exit-stop. Throws
- * SystemError on failure or returns false if the tracee doesn't exist. */
-bool get_syscall_ret(pid_t pid, size_t& retval);
+/* Describes the syscall-related stop that a tracee is currently in. */
+struct SyscallStop
+{
+    enum Op
+    {
+        NONE,       // not in a syscall-stop at all
+        ENTRY,      // syscall-entry-stop
+        EXIT,       // syscall-exit-stop
+        SECCOMP,    // PTRACE_EVENT_SECCOMP stop (entry to a filtered syscall)
+    };
+
+    Op op;
+    int syscall;                // valid for ENTRY and SECCOMP
+    size_t args[SYS_ARG_MAX];   // valid for ENTRY and SECCOMP
+    size_t retval;              // valid for EXIT
+};
+
+/* Finds out which syscall-stop the tracee is in, along with the syscall and
+ * its arguments (for an entry) or the return value (for an exit), all with a
+ * single PTRACE_GET_SYSCALL_INFO call. Kernels older than 5.3 don't support
+ * that, so we fall back to reading the registers - but then we can't tell an
+ * entry from an exit, so the caller has to tell us what it's expecting with
+ * `expected` (which is also what ends up in stop.op). Throws SystemError on
+ * failure or returns false if the tracee doesn't exist. */
+bool get_syscall_stop(pid_t pid, SyscallStop::Op expected, SyscallStop& stop);
 
 #endif /* FORKTRACE_PTRACE_HPP */
@@ -0,0 +1,263 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  stats
+ *
+ *      See stats.hpp. Everything is a relaxed atomic so that the counters can
+ *      be bumped from any thread without a lock, and we only ever need a rough
+ *      snapshot of them.
+ */
+#include <atomic>
+#include <iterator>
+#include <string>
+#include <sys/ptrace.h>
+#include <fmt/core.h>
+
+#include "stats.hpp"
+
+using std::string;
+using fmt::format;
+
+/* The ptrace requests that we count separately (anything else gets counted
+ * as "other"). */
+static const struct
+{
+    int request;
+    const char* name;
+} PTRACE_REQUESTS[] = {
+    { PTRACE_TRACEME, "TRACEME" },
+    { PTRACE_SEIZE, "SEIZE" },
+    { PTRACE_INTERRUPT, "INTERRUPT" },
+    { PTRACE_SETOPTIONS, "SETOPTIONS" },
+    { PTRACE_CONT, "CONT" },
+    { PTRACE_SYSCALL, "SYSCALL" },
+    { PTRACE_DETACH, "DETACH" },
+    { PTRACE_GETREGS, "GETREGS" },
+    { PTRACE_GET_SYSCALL_INFO, "GET_SYSCALL_INFO" },
+    { PTRACE_PEEKUSER, "PEEKUSER" },
+    { PTRACE_POKEUSER, "POKEUSER" },
+    { PTRACE_PEEKDATA, "PEEKDATA" },
+    { PTRACE_POKEDATA, "POKEDATA" },
+    { PTRACE_GETEVENTMSG, "GETEVENTMSG" },
+    { PTRACE_GETSIGINFO, "GETSIGINFO" },
+};
+
+constexpr size_t NUM_PTRACE_REQUESTS = std::size(PTRACE_REQUESTS);
+
+static const char* const MEMORY_CALL_NAMES[] = {
+    "process_vm_readv",
+    "process_vm_writev",
+    "pread(/proc/<pid>/mem)",
+    "pwrite(/proc/<pid>/mem)",
+};
+
+static const char* const STOP_NAMES[] = {
+    "syscall-entry",
+    "syscall-exit",
+    "seccomp",
+    "signal",
+    "ptrace-event",
+    "exit",
+};
+
+static_assert(std::size(MEMORY_CALL_NAMES)
+    == size_t(MemoryCall::NUM_MEMORY_CALLS));
+static_assert(std::size(STOP_NAMES) == size_t(Stop::NUM_STOP_KINDS));
+
+/* Bucket i of the histogram holds stop times in [2^(i-1), 2^i) microseconds
+ * (bucket 0 is anything under a microsecond, and the last one is everything
+ * from about 30 seconds up). */
+constexpr size_t NUM_BUCKETS = 26;
+
+static std::atomic<size_t> gPtraceCalls[NUM_PTRACE_REQUESTS + 1]; // + other
+static std::atomic<size_t> gMemoryCalls[size_t(MemoryCall::NUM_MEMORY_CALLS)];
+static std::atomic<size_t> gStops[size_t(Stop::NUM_STOP_KINDS)];
+static std::atomic<size_t> gBytesCopied;
+static std::atomic<size_t> gOrphans;
+static std::atomic<size_t> gStopTimes[NUM_BUCKETS];
+static std::atomic<uint64_t> gTotalStopTime; // in nanoseconds
+
+/* Shorthand, since none of these need to be ordered with anything else. */
+static void add(std::atomic<size_t>& counter, size_t n = 1)
+{
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+static size_t get(const std::atomic<size_t>& counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+void count_ptrace(int request)
+{
+    size_t i = 0;
+    while (i < NUM_PTRACE_REQUESTS && PTRACE_REQUESTS[i].request != request)
+    {
+        ++i;
+    }
+    add(gPtraceCalls[i]);
+    if (request == PTRACE_PEEKDATA)
+    {
+        add(gBytesCopied, sizeof(long));
+    }
+}
+
+void count_memory_call(MemoryCall call)
+{
+    add(gMemoryCalls[size_t(call)]);
+}
+
+void count_stop(Stop kind)
+{
+    add(gStops[size_t(kind)]);
+}
+
+void count_bytes_copied(size_t bytes)
+{
+    add(gBytesCopied, bytes);
+}
+
+void count_orphan()
+{
+    add(gOrphans);
+}
+
+void record_stop_time(std::chrono::steady_clock::duration time)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time);
+    uint64_t us = ns.count() / 1000;
+    size_t bucket = 0;
+    while (us != 0 && bucket + 1 < NUM_BUCKETS)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    add(gStopTimes[bucket]);
+    gTotalStopTime.fetch_add(ns.count(), std::memory_order_relaxed);
+}
+
+/* Formats 2^(bucket-1) microseconds (the lower bound of a bucket). */
+static string bucket_bound(size_t bucket)
+{
+    if (bucket == 0)
+    {
+        return "0";
+    }
+    uint64_t us = uint64_t(1) << (bucket - 1);
+    if (us >= 1000000)
+    {
+        return format("{}s", us / 1000000);
+    }
+    if (us >= 1000)
+    {
+        return format("{}ms", us / 1000);
+    }
+    return format("{}us", us);
+}
+
+/* Works out which bucket the given fraction of stop times falls into. */
+static size_t percentile(const size_t* counts, size_t total, double fraction)
+{
+    size_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen >= total * fraction)
+        {
+            return i;
+        }
+    }
+    return NUM_BUCKETS - 1;
+}
+
+string format_stats()
+{
+    string out;
+    size_t total = 0;
+    for (auto& count : gStops)
+    {
+        total += get(count);
+    }
+    out += format("wait notifications: {}\n", total);
+    for (size_t i = 0; i < size_t(Stop::NUM_STOP_KINDS); ++i)
+    {
+        out += format("    {:<24}{}\n", STOP_NAMES[i], get(gStops[i]));
+    }
+
+    total = 0;
+    for (auto& count : gPtraceCalls)
+    {
+        total += get(count);
+    }
+    out += format("ptrace calls: {}\n", total);
+    for (size_t i = 0; i <= NUM_PTRACE_REQUESTS; ++i)
+    {
+        size_t count = get(gPtraceCalls[i]);
+        if (count != 0)
+        {
+            const char* name = i < NUM_PTRACE_REQUESTS
+                ? PTRACE_REQUESTS[i].name : "other";
+            out += format("    {:<24}{}\n", name, count);
+        }
+    }
+
+    out += "other memory syscalls:\n";
+    for (size_t i = 0; i < size_t(MemoryCall::NUM_MEMORY_CALLS); ++i)
+    {
+        out += format("    {:<24}{}\n", MEMORY_CALL_NAMES[i],
+            get(gMemoryCalls[i]));
+    }
+    out += format("bytes copied from tracees: {}\n", get(gBytesCopied));
+    out += format("orphans: {}\n", get(gOrphans));
+
+    size_t counts[NUM_BUCKETS];
+    total = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        counts[i] = get(gStopTimes[i]);
+        total += counts[i];
+    }
+    out += format("time spent stopped: {} stops", total);
+    if (total == 0)
+    {
+        return out + "\n";
+    }
+    uint64_t mean = gTotalStopTime.load(std::memory_order_relaxed) / total;
+    out += format(", mean {}us, p50 < {}, p90 < {}, p99 < {}\n", mean / 1000,
+        bucket_bound(percentile(counts, total, 0.5) + 1),
+        bucket_bound(percentile(counts, total, 0.9) + 1),
+        bucket_bound(percentile(counts, total, 0.99) + 1));
+    for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        if (counts[i] != 0)
+        {
+            string range = i + 1 < NUM_BUCKETS
+                ? format("[{}, {})", bucket_bound(i), bucket_bound(i + 1))
+                : format("[{}, ...)", bucket_bound(i));
+            out += format("    {:<24}{}\n", range, counts[i]);
+        }
+    }
+    return out;
+}
+
+void reset_stats()
+{
+    for (auto& count : gPtraceCalls)
+    {
+        count = 0;
+    }
+    for (auto& count : gMemoryCalls)
+    {
+        count = 0;
+    }
+    for (auto& count : gStops)
+    {
+        count = 0;
+    }
+    for (auto& count : gStopTimes)
+    {
+        count = 0;
+    }
+    gBytesCopied = 0;
+    gOrphans = 0;
+    gTotalStopTime = 0;
+}
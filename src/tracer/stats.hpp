@@ -0,0 +1,69 @@
+/*  Copyright (C) 2020  Henry Harvey --- See LICENSE file
+ *
+ *  stats
+ *
+ *      Counters (and a histogram) for working out where the tracer spends its
+ *      time. These get updated from the hot paths in tracer.cpp, ptrace.cpp
+ *      and memory.cpp, so they're just relaxed atomics and are always on. See
+ *      the `stats` command and the --stats option.
+ */
+#ifndef FORKTRACE_STATS_HPP
+#define FORKTRACE_STATS_HPP
+
+#include <chrono>
+#include <string>
+
+/* The kinds of ptrace-stop (and other wait notification) that we count. */
+enum class Stop
+{
+    SYSCALL_ENTRY,  // syscall-enter-stop (without the seccomp filter)
+    SYSCALL_EXIT,   // syscall-exit-stop
+    SECCOMP,        // PTRACE_EVENT_SECCOMP stop (a filtered syscall entry)
+    SIGNAL,         // signal-delivery-stop or group-stop
+    EVENT,          // any other PTRACE_EVENT stop (fork, exec, exit etc.)
+    END,            // not a stop, the tracee exited or was killed
+    NUM_STOP_KINDS, // must be the last item in the list.
+};
+
+/* Counts a ptrace call. `request` is the PTRACE_* request. A PTRACE_PEEKDATA
+ * also counts as a word's worth of bytes copied (see count_bytes_copied). */
+void count_ptrace(int request);
+
+/* Use this instead of calling ptrace directly, so that the call gets counted.
+ * It takes the same arguments as ptrace (and <sys/ptrace.h> is still needed). */
+#define PTRACE(request, ...) (count_ptrace(request), ptrace(request, __VA_ARGS__))
+
+/* The syscalls other than ptrace that we use to get at a tracee's memory. */
+enum class MemoryCall
+{
+    VM_READV,       // process_vm_readv
+    VM_WRITEV,      // process_vm_writev
+    MEM_READ,       // pread on /proc/<pid>/mem
+    MEM_WRITE,      // pwrite on /proc/<pid>/mem
+    NUM_MEMORY_CALLS, // must be the last item in the list.
+};
+
+/* Counts a syscall that read from (or wrote to) a tracee's memory without going
+ * through ptrace (see memory.cpp). */
+void count_memory_call(MemoryCall call);
+
+/* Counts a wait notification for a tracee. */
+void count_stop(Stop kind);
+
+/* Counts bytes that we copied out of a tracee's address space. */
+void count_bytes_copied(size_t bytes);
+
+/* Counts an orphan that was passed on to us. */
+void count_orphan();
+
+/* Records how long a tracee stayed stopped for (from when we got its wait
+ * notification to when we resumed it). */
+void record_stop_time(std::chrono::steady_clock::duration time);
+
+/* Puts everything that's been counted so far into a human readable report. */
+std::string format_stats();
+
+/* Sets everything back to zero. */
+void reset_stats();
+
+#endif /* FORKTRACE_STATS_HPP */
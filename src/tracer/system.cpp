@@ -79,6 +79,10 @@ string_view get_syscall_name(int syscall)
     {
         return "forktrace";
     }
+    if (syscall == SYSCALL_CLONE3)
+    {
+        return "clone3"; // too new for the table
+    }
     if (syscall < 0 || syscall >= (int)ARRAY_SIZE(syscalls)) 
     {
         return "?????";
@@ -124,6 +128,10 @@ string diagnose_wait_status(int status)
         {
             return "exit event";
         }
+        else if (IS_SECCOMP_EVENT(status))
+        {
+            return "seccomp event";
+        }
         else if (IS_SYSCALL_EVENT(status))
         {
             return "syscall event";
@@ -8,6 +8,8 @@
 #define FORKTRACE_SYSTEM_HPP
 
 #include <string>
+#include <ctime>
+#include <sys/resource.h>
 
 /* Wouldn't be hard to port to other architectures as long as it's to Linux.
  * Main things you'd have to change would just be specific register stuff in
@@ -55,6 +57,7 @@ enum SystemCall : int
     SYSCALL_TGKILL = 234,   // send a signal to specific thread (recommended)
     SYSCALL_WAITID = 247,   // cover all our bases
     SYSCALL_EXECVEAT = 322, // same as execve with extra features
+    SYSCALL_CLONE3 = 435,   // newer clone (glibc uses it for pthreads)
     SYSCALL_NONE = -1,      // sentinel value
     SYSCALL_FAKE = -2,      // for our own nefarious purposes
 };
@@ -82,6 +85,16 @@ int get_syscall_arg_count(int syscall);
 /* Get the name corresponding to a signal number (or "?????" if none) */
 std::string_view get_signal_name(int signal);
 
+/* What we know about a process that has been reaped (e.g., an orphan that the
+ * reaper process reaped for us). */
+struct ReapInfo
+{
+    int status;             // its wait status
+    unsigned long long startTime; // when it started (see get_start_time)
+    struct timespec time;   // when it was reaped (CLOCK_MONOTONIC)
+    struct rusage rusage;   // its resource usage (from wait4)
+};
+
 /* Returns a string describing the provided wait(2) child status. This will
  * include events like ptrace(2) events (see ptrace.hpp). If the event was
  * unknown, a string describing the raw number is returned. */
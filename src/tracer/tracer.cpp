@@ -1,16 +1,21 @@
 #include <string>
+#include <utility>
+#include <chrono>
 #include <unistd.h>
 #include <cassert>
 #include <iostream>
 #include <cstring>
 #include <fmt/core.h>
+#include <signal.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
 
 #include "tracer.hpp"
 #include "process.hpp"
 #include "system.hpp"
 #include "util.hpp"
 #include "ptrace.hpp"
+#include "stats.hpp"
 
 using std::string;
 using std::string_view;
@@ -37,21 +42,24 @@ static BadTraceError diagnose_bad_event(Tracee& tracee, int status, string msg)
     {
         msg += format(" (syscall={})", get_syscall_name(tracee.syscall));
     }
-    if (IS_SYSCALL_EVENT(status))
+    if (IS_SYSCALL_EVENT(status) || IS_SECCOMP_EVENT(status))
     {
         try
         {
-            int syscall;
-            size_t args[SYS_ARG_MAX]; // ignore
-            if (which_syscall(tracee.pid, syscall, args))
+            SyscallStop stop;
+            SyscallStop::Op expected = tracee.syscall == SYSCALL_NONE 
+                ? SyscallStop::ENTRY : SyscallStop::EXIT;
+            if (!get_syscall_stop(tracee.pid, expected, stop))
             {
-                // Be careful with interpreting this. If it's a syscall-exit-
-                // stop (not an entry), then this could be anything. ?TODO?
-                msg += format(" (reg={})", get_syscall_name(syscall));
+                msg += " (got ESRCH when probing further)";
             }
-            else
+            else if (stop.op == SyscallStop::EXIT)
             {
-                msg += " (got ESRCH when probing further)";
+                msg += format(" (exit, retval={})", (long)stop.retval);
+            }
+            else if (stop.op != SyscallStop::NONE)
+            {
+                msg += format(" (reg={})", get_syscall_name(stop.syscall));
             }
         }
         catch (const std::exception& e) 
@@ -66,37 +74,76 @@ static BadTraceError diagnose_bad_event(Tracee& tracee, int status, string msg)
  * BLOCKING CALL CLASSES
  *****************************************************************************/
 
-/* We use this class to keep track of blocking system calls. When a tracee 
- * reaches a syscall-entry-stop for a blocking syscall that we care about,
- * we'll use this class to maintain the state of the system call so that we
- * can finish it at a later time. This class may still be used to represent
- * system calls do not always block (e.g., wait/waitpid with WNOHANG). */
+/* We use this class to keep track of system calls that span more than one
+ * stop of the tracee. When a tracee reaches a syscall-entry-stop for one of
+ * these syscalls, we'll use this class to maintain the state of the system
+ * call so that we can finish it at a later time. We never wait on a specific
+ * tracee - each stop is handled by the main wait loop in step() as it comes
+ * in, and gets passed along to the tracee's BlockingCall (if it has one). 
+ * This way, a tracee that is slow to finish a fork won't hold up any of the
+ * other tracees. This class may still be used to represent system calls do 
+ * not always block (e.g., wait/waitpid with WNOHANG). */
 class BlockingCall 
 {
 public:
     virtual ~BlockingCall() { }
 
     /* Returns false if the tracee died while trying to prepare or finalise
-     * the call. Throws an exception if some other error occurred. 
+     * the call. Throws an exception if some other error occurred. The call is
+     * finalised at its syscall-exit-stop, and `retval` is its return value.
      *
      * Cleanup:
      *  If false is returned, then reaping the tracee is left to the caller
      */
     virtual bool prepare(Tracer& tracer, Tracee& tracee) = 0;
-    virtual bool finalise(Tracer& tracer, Tracee& tracee) = 0;
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval) = 0;
+
+    /* Called when the tracee stops for a ptrace event (e.g., a fork or exec
+     * event) in the middle of the call. The tracee gets resumed afterwards.
+     * Throws a BadTraceError by default, since most calls don't expect any.
+     * Returns false if the tracee died (same cleanup as above). */
+    virtual bool on_event(Tracer& tracer, Tracee& tracee, int status);
+
+    /* Called when the tracee exits or gets killed in the middle of the call
+     * (before the process tree gets notified about it). */
+    virtual void on_ended(Tracer& tracer, Tracee& tracee, int status) { }
+
+    /* If this returns true after the call was finalised, then the tracee is
+     * left in its syscall-exit-stop instead of being resumed straight away.
+     * We do this after a fork/exec/kill so that step() stops after them. */
+    virtual bool keep_stopped() const { return false; }
+
+    /* Returns true if the call may block for an unbounded amount of time,
+     * possibly waiting on some other tracee to do something (e.g., wait). */
+    virtual bool blocking() const { return false; }
 };
 
-Tracee::Tracee(pid_t pid, shared_ptr<Process> process)
-    : pid(pid), state(STOPPED), syscall(SYSCALL_NONE),
-    signal(0), process(std::move(process))
+bool BlockingCall::on_event(Tracer& tracer, Tracee& tracee, int status)
+{
+    throw diagnose_bad_event(tracee, status, "Got event at weird time.");
+}
+
+Tracee::Tracee(pid_t pid, Process* process)
+    : pid(pid), tgid(pid), state(STOPPED), syscall(SYSCALL_NONE),
+    signal(0), awaitingInitialStop(false), attached(false), lifecycle(false),
+    excluded(false), selected(false), depth(0), startTime(0), stops(0),
+    stoppedAt(), windowStops(0), throttled(false), process(process), 
+    memory(pid)
 {
     // has to go after declaration of BlockingCall to keep unique_ptr happy
 }
 
 Tracee::Tracee(Tracee&& tracee) 
-    : pid(tracee.pid), state(tracee.state), syscall(tracee.syscall), 
-    signal(tracee.signal), blockingCall(std::move(tracee.blockingCall)),
-    process(std::move(tracee.process))
+    : pid(tracee.pid), tgid(tracee.tgid), state(tracee.state), 
+    syscall(tracee.syscall), 
+    signal(tracee.signal), awaitingInitialStop(tracee.awaitingInitialStop),
+    attached(tracee.attached), lifecycle(tracee.lifecycle),
+    excluded(tracee.excluded), selected(tracee.selected), depth(tracee.depth), 
+    startTime(tracee.startTime), stops(tracee.stops), 
+    stoppedAt(tracee.stoppedAt),
+    windowStops(tracee.windowStops), windowStart(tracee.windowStart),
+    throttled(tracee.throttled), blockingCall(std::move(tracee.blockingCall)),
+    process(tracee.process), memory(std::move(tracee.memory))
 {
     // has to go after declaration of BlockingCall to keep unique_ptr happy
 }
@@ -106,12 +153,52 @@ Tracee::~Tracee()
     // has to go after declaration of BlockingCall to keep unique_ptr happy
 }
 
+/* How long to wait for the reaper to tell us that a tracee was orphaned before
+ * we decide that its parent must have reaped it instead (see _infer_reaps). */
+static constexpr auto ORPHAN_GRACE = std::chrono::milliseconds(100);
+
+/* Blocks until at least one wait status is ready, and then grabs all the other
+ * ones that are ready too (without blocking), so that they can be handled all
+ * in one go. Each tracee stays stopped until we resume it, so this can't go on
+ * forever. The flags are passed on to wait4 (if they include WNOHANG, then
+ * we don't block at all and the batch could be empty). Returns false (with 
+ * errno set) if the first wait4 failed. If `reaps` isn't null, then we also
+ * put the resource usage of anything that ended in there (along with its
+ * status and when we got it), in case the wait turns out to have reaped it.
+ * That leaves just the start time for the caller to fill in. */
+static bool wait_for_batch(vector<std::pair<pid_t, int>>& batch, int flags,
+                           vector<std::pair<pid_t, ReapInfo>>* reaps = nullptr)
+{
+    batch.clear();
+    if (reaps != nullptr)
+    {
+        reaps->clear();
+    }
+    int status;
+    struct rusage usage;
+    struct rusage* usagePtr = reaps != nullptr ? &usage : nullptr;
+    pid_t pid = wait4(-1, &status, flags, usagePtr);
+    while (pid > 0)
+    {
+        batch.emplace_back(pid, status);
+        if (reaps != nullptr && (WIFEXITED(status) || WIFSIGNALED(status)))
+        {
+            ReapInfo info = {};
+            info.status = status;
+            info.rusage = usage;
+            clock_gettime(CLOCK_MONOTONIC, &info.time);
+            reaps->emplace_back(pid, info);
+        }
+        pid = wait4(-1, &status, flags | WNOHANG, usagePtr);
+    }
+    return pid == 0 || !batch.empty();
+}
+
 /* A sub-class of BlockingCall specialised for wait calls (wait4 or waitid).
- * This class does a bunch of trickery to obtain the result of the wait call,
- * even when the tracee program specifies 'NULL' as the argument to the result
- * value. What we have to do in that case is pick some random readable/writable
- * address in the tracees memory space, and use that for the result instead (we
- * then have to modify the system call to point to that instead). 
+ * If the tracee gave the call somewhere to put its result, then we read it
+ * from there afterwards. If it passed NULL instead, then we don't touch its
+ * memory at all. We work out what happened from the return value and from what
+ * we know about its children instead (see _correlate).
  *
  * Template arguments:
  *
@@ -119,47 +206,55 @@ Tracee::~Tracee()
  *
  *  ZeroTheResult : Whether we should zero out the result memory before passing
  *      it into the wait call.
- *
- *  ResultArgIndex : The index of the argument that points to where the result
- *      should be written.
  */
-template <class Result, bool ZeroTheResult, int ResultArgIndex>
+template <class Result, bool ZeroTheResult>
 class WaitCall : public BlockingCall 
 {
 private:
     pid_t _waitedId; // same meaning as pid argument of waitpid(2)
-    bool _nohang; // does this have WNOHANG?
-    Result* _result; // address in tracee's memory space
-    unique_ptr<Result> _oldData; // backup of the old data at _result.
+    int _flags; // the options argument (WNOHANG etc.)
+    Result* _result; // address in tracee's memory space (can be null)
+
+    pid_t _find_reaped(Tracer& tracer, Tracee& tracee);
 
 protected:
     WaitCall(pid_t target, Result* result, int flags) 
-        : _waitedId(target), _nohang(flags & WNOHANG), _result(result) { }
+        : _waitedId(target), _flags(flags), _result(result) { }
 
-    /* Prepare the wait call, modifying its parameters in the event that the
-     * user didn't provide us with a location to store the result.
-     *
-     * Cleanup:
-     *  If false is returned, then reaping the tracee is left to the caller.
-     */
+    /* Notifies the process tree that the wait has begun (and zeroes the
+     * result if we need to). */
     virtual bool prepare(Tracer& tracer, Tracee& tracee);
 
-    /* Retrieve the result and return value of the wait call. Return false if
-     * the tracee died and throw an exception if some error occurred. */
-    bool _get_result(pid_t pid, Result& result, size_t& retval);
+    /* Retrieve the result of the wait call. Only call this if the call
+     * succeeded and has_result() is true. Return false if the tracee died and
+     * throw an exception if some error occurred. */
+    bool _get_result(Tracee& tracee, Result& result);
+
+    /* Does the wait call have somewhere to put its result? */
+    bool _has_result() const { return _result != nullptr; }
+
+    /* Does the wait call have this flag (e.g., WNOHANG)? */
+    bool _has_flag(int flag) const { return (_flags & flag) != 0; }
 
     /* Calling these will update the process tree if necessary */
     void _on_success(Tracer& tracer, Tracee& tracee, pid_t reaped);
     void _on_failure(Tracer& tracer, Tracee& tracee, int error);
+
+    /* Call this when a wait call without a result succeeded. `chosen` is the
+     * child that it returned, or 0 if we don't know (waitid). */
+    void _correlate(Tracer& tracer, Tracee& tracee, pid_t chosen);
+
+public:
+    virtual bool blocking() const { return true; }
 };
 
-class Wait4Call : public WaitCall<int, false, 1> 
+class Wait4Call : public WaitCall<int, false> 
 {
 public:
     Wait4Call(pid_t pid, int* status, int flags) 
-        : WaitCall<int, false, 1>(pid, status, flags) { }
+        : WaitCall<int, false>(pid, status, flags) { }
 
-    virtual bool finalise(Tracer& tracer, Tracee& tracee);
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval);
 };
 
 /* Converts the arguments used by waitid to the pid argument used by wait4.
@@ -180,119 +275,235 @@ pid_t to_wait4_id(idtype_t type, id_t id)
     }
 }
 
-class WaitIDCall : public WaitCall<siginfo_t, true, 2> 
+class WaitIDCall : public WaitCall<siginfo_t, true> 
 {
 public:
     WaitIDCall(idtype_t type, id_t id, siginfo_t* infop, int flags) 
-        : WaitCall<siginfo_t, true, 2>(to_wait4_id(type, id), infop, flags) { }
+        : WaitCall<siginfo_t, true>(to_wait4_id(type, id), infop, flags) { }
+
+    virtual bool finalise(Tracer& tracer, Tracee& t, size_t retval);
+};
+
+/* For fork, vfork and fork-like clones. We expect a fork event (if the fork
+ * succeeded) followed by the syscall-exit-stop. The new child will be stopped
+ * by a SIGSTOP, which may turn up at any time (even before the fork event -
+ * see Tracer::_claim_stops). After a vfork, the syscall-exit-stop only comes
+ * once the child has execed or exited. */
+class ForkCall : public BlockingCall
+{
+private:
+    bool _forked; // have we gotten the fork event yet?
+    bool _vfork; // are we suspended until the child execs or exits?
+
+    void _vfork_done(Tracer& tracer);
+
+public:
+    ForkCall(bool vfork) : _forked(false), _vfork(vfork) { }
+
+    virtual bool prepare(Tracer& tracer, Tracee& tracee) { return true; }
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval);
+    virtual bool on_event(Tracer& tracer, Tracee& tracee, int status);
+    virtual void on_ended(Tracer& tracer, Tracee& tracee, int status);
+    virtual bool keep_stopped() const { return _forked; }
+};
+
+/* For clones that create a new thread in the caller's thread group. We expect
+ * a clone event, and the new thread gets its own Tracee that shares the
+ * caller's Process (threads don't show up in the diagram by themselves). */
+class ThreadCall : public BlockingCall
+{
+public:
+    virtual bool prepare(Tracer& tracer, Tracee& tracee) { return true; }
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval);
+    virtual bool on_event(Tracer& tracer, Tracee& tracee, int status);
+};
+
+/* For execve and execveat. We expect an exec event (if the exec succeeded)
+ * followed by the syscall-exit-stop. */
+class ExecveCall : public BlockingCall
+{
+private:
+    string _file;
+    vector<string> _args;
+    bool _execed; // have we gotten the exec event yet?
+
+public:
+    ExecveCall(string file, vector<string> args)
+        : _file(std::move(file)), _args(std::move(args)), _execed(false) { }
 
-    virtual bool finalise(Tracer& tracer, Tracee& t);
+    virtual bool prepare(Tracer& tracer, Tracee& tracee) { return true; }
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval);
+    virtual bool on_event(Tracer& tracer, Tracee& tracee, int status);
+    virtual bool keep_stopped() const { return _execed; }
+};
+
+/* For kill, tkill and tgkill. */
+class KillCall : public BlockingCall
+{
+private:
+    pid_t _target;
+    int _signal;
+    bool _toThread; // for tkill and tgkill
+    bool _sent; // did the call succeed at sending a signal?
+
+public:
+    KillCall(pid_t target, int signal, bool toThread) 
+        : _target(target), _signal(signal), _toThread(toThread), 
+        _sent(false) { }
+
+    virtual bool prepare(Tracer& tracer, Tracee& tracee) { return true; }
+    virtual bool finalise(Tracer& tracer, Tracee& tracee, size_t retval);
+    virtual void on_ended(Tracer& tracer, Tracee& tracee, int status);
+    virtual bool keep_stopped() const { return _sent; }
 };
 
 /******************************************************************************
  * EVENT TRACING LOGIC
  *****************************************************************************/
 
-template <class Result, bool ZeroTheResult, int ResultArgIndex>
-bool WaitCall<Result, ZeroTheResult, ResultArgIndex>
-::prepare(Tracer& tracer, Tracee& tracee) 
+template <class Result, bool ZeroTheResult>
+bool WaitCall<Result, ZeroTheResult>::prepare(Tracer& tracer, Tracee& tracee) 
 {
-    pid_t pid = tracee.pid;
-    if (_result == nullptr) 
+    if (ZeroTheResult && _result != nullptr) 
     {
-        // The tracee specified NULL for the address of the result, so find
-        // some block of memory in the tracee that we can use to store the
-        // syscall's result.
-        if (!get_tracee_result_addr(pid, (void*&)_result)) 
-        {
-            return false;
-        }
-        // Save the old data that was stored at that address.
-        _oldData = std::make_unique<Result>();
-        try 
+        try
         {
-            if (!copy_from_tracee(pid, _oldData.get(), _result, sizeof(Result))) 
+            if (!tracee.memory.fill(_result, 0, sizeof(Result)))
             {
-                return false;
+                return false; 
             }
-        } 
+        }
         catch (const SystemError& e) 
         {
-            // intercept EFAULT/EIO, which will occur if the tracee specifies
-            // a bad memory address as the result argument for the wait call.
-            // If that has happened, then we'll indicate that by setting both
-            // _oldData and _result to null. Then when we come to finalise the
-            // wait call, we'll just let it fail.
+            // The tracee gave us a bad address (EFAULT or EIO), so the wait
+            // call will just fail with EFAULT, and we won't need the result.
             if (e.code() != EFAULT && e.code() != EIO) 
             {
-                throw; // rethrow it
+                throw;
             }
-            _oldData.reset();
-            _result = nullptr;
-            return true;
-        }
-        // Now change the syscall argument to point to this block of memory.
-        if (!set_syscall_arg(pid, (size_t)_result, ResultArgIndex)) 
-        {
-            return false;
         }
     }
-    if (ZeroTheResult && !memset_tracee(pid, _result, 0, sizeof(Result))) 
-    {
-        return false; 
-    }
     // Now we notify the process tree that the wait has begun!
-    tracee.process->notify_waiting(_waitedId, _nohang);
+    tracee.process->notify_waiting(_waitedId, _has_flag(WNOHANG), tracee.pid);
     return true;
 }
 
-template <class Result, bool ZeroTheResult, int ResultArgIndex>
-bool WaitCall<Result, ZeroTheResult, ResultArgIndex>
-::_get_result(pid_t pid, Result& result, size_t& retval) 
+template <class Result, bool ZeroTheResult>
+bool WaitCall<Result, ZeroTheResult>::_get_result(Tracee& tracee, 
+                                                  Result& result) 
 {
-    // If _result and _oldData are null, then that indicates that the address
-    // specified by the tracee for the result is invalid and thus the system
-    // call will fail with a memory fault.
-    if (_oldData == nullptr && _result == nullptr) 
-    {
-        retval = -1; // what wait calls return on error
-        return true;
-    }
-    // Retrieve the return value of the syscall
-    if (!get_syscall_ret(pid, retval)) 
+    assert(_result != nullptr);
+    return tracee.memory.read(&result, _result, sizeof(Result));
+}
+
+template <class Result, bool ZeroTheResult>
+void WaitCall<Result, ZeroTheResult>
+::_correlate(Tracer& tracer, Tracee& tracee, pid_t chosen)
+{
+    if (chosen == 0)
     {
-        return false;
+        if (_has_flag(WNOWAIT))
+        {
+            return; // the child is still a zombie
+        }
+        chosen = _find_reaped(tracer, tracee);
+        if (chosen == 0)
+        {
+            // Nothing of ours was reaped, so it must've been a stopped or
+            // continued child (or nothing at all with WNOHANG).
+            return;
+        }
     }
-    // Retrieve the result of the wait call
-    if (!copy_from_tracee(pid, &result, _result, sizeof(Result))) 
+    else if (_has_flag(WUNTRACED | WCONTINUED))
     {
-        return false;
+        // Without the status, the only way we can tell that it wasn't just a
+        // stop or a continue is that we've already seen the child end.
+        auto it = tracer._tracees.find(chosen);
+        bool ended = (it != tracer._tracees.end())
+            ? it->second.state == Tracee::DEAD
+            : tracer._detached.count(chosen) != 0;
+        if (!ended)
+        {
+            return;
+        }
     }
-    if (_oldData != nullptr) 
-    {
-        // If _oldData isn't null, then that means we had to pick a random
-        // address in the tracee's memory. Let's restore that.
-        if (!copy_to_tracee(pid, _result, _oldData.get(), sizeof(Result))) 
+    _on_success(tracer, tracee, chosen);
+}
+
+/* Works out which child a waitid call without a result reaped (it only ever
+ * returns 0). The tracee's children that we've seen end are zombies until they
+ * get reaped, so it's whichever one of those isn't a zombie anymore. Returns 0
+ * if there isn't one. */
+template <class Result, bool ZeroTheResult>
+pid_t WaitCall<Result, ZeroTheResult>::_find_reaped(Tracer& tracer, 
+                                                    Tracee& tracee)
+{
+    // We can't check the process group of a zombie, so any child will do for
+    // a process group wait.
+    auto waited = [&](pid_t pid) { return _waitedId <= 0 || _waitedId == pid; };
+    ProcessTree& tree = tracee.process->tree();
+    for (ProcessId id : tracee.process->unreaped_children())
+    {
+        const Process& child = tree.get(id);
+        pid_t pid = child.pid();
+        if (!waited(pid))
         {
-            return false;
+            continue;
         }
-        // Restore the syscall arg just to be safe. Might not be necessary
-        // depending on the syscall calling convention for this architecture.
-        if (!set_syscall_arg(pid, 0, ResultArgIndex)) 
+        if (child.detached())
         {
-            return false;
+            // These ones aren't traced anymore, so we don't know when they 
+            // end. If they're gone altogether (or the PID belongs to someone
+            // else now), then it must've been reaped.
+            auto detached = tracer._detached.find(pid);
+            unsigned long long startTime;
+            if (tracer._tracees.count(pid) == 0 
+                && detached != tracer._detached.end()
+                && (!get_start_time(pid, startTime) 
+                    || (detached->second.startTime != 0
+                        && startTime != detached->second.startTime)))
+            {
+                return pid;
+            }
+            continue;
+        }
+        auto it = tracer._tracees.find(pid);
+        if (it != tracer._tracees.end() && it->second.process == &child
+            && it->second.state == Tracee::DEAD && !it->second.excluded
+            && !is_zombie(pid))
+        {
+            return pid;
         }
     }
-    return true;
+    return 0;
 }
 
-template <class Result, bool ZeroTheResult, int ResultArgIndex>
-void WaitCall<Result, ZeroTheResult, ResultArgIndex>
+template <class Result, bool ZeroTheResult>
+void WaitCall<Result, ZeroTheResult>
 ::_on_success(Tracer& tracer, Tracee& tracee, pid_t chosen)
 {
     auto it = tracer._tracees.find(chosen);
-    if (it == tracer._tracees.end())
+    if (it == tracer._tracees.end() || it->second.excluded)
+    {
+        // If it's one that we left out (see Tracer::_exclude), then it might
+        // still be a tracee until we've handled its exit status.
+        auto detached = tracer._detached.find(chosen);
+        if (detached != tracer._detached.end())
+        {
+            tracee.process->notify_reaped(*detached->second.process, 
+                tracee.pid);
+            tracer._detached.erase(detached);
+            return;
+        }
+    }
+    if (it == tracer._tracees.end() || it->second.excluded)
     {
+        if (tracee.attached)
+        {
+            // Probably one that we couldn't attach to (see Tracer::_attach).
+            verbose("{} reaped untraced child {}", tracee.pid, chosen);
+            return;
+        }
         throw BadTraceError(tracee.pid, 
             format("Tracee reaped an unknown child ({}).", chosen));
     }
@@ -301,77 +512,145 @@ void WaitCall<Result, ZeroTheResult, ResultArgIndex>
         throw BadTraceError(tracee.pid,
             format("Tracee reaped a child ({}) that wasn't dead.", chosen));
     }
-    tracee.process->notify_reaped(it->second.process);
-    tracer._tracees.erase(it);
+    tracee.process->notify_reaped(*it->second.process, tracee.pid);
+    tracer._remove_tracee(it->second);
 }
 
-template <class Result, bool ZeroTheResult, int ResultArgIndex>
-void WaitCall<Result, ZeroTheResult, ResultArgIndex>
+template <class Result, bool ZeroTheResult>
+void WaitCall<Result, ZeroTheResult>
 ::_on_failure(Tracer& tracer, Tracee& tracee, int error)
 {
-    tracee.process->notify_failed_wait(error);
+    tracee.process->notify_failed_wait(error, tracee.pid);
 }
 
-bool Wait4Call::finalise(Tracer& tracer, Tracee& tracee) 
+bool Wait4Call::finalise(Tracer& tracer, Tracee& tracee, size_t retval) 
 {
+    if ((pid_t)retval < 0) 
+    {
+        _on_failure(tracer, tracee, -(int)retval);
+        return true;
+    }
+    if ((pid_t)retval == 0)
+    {
+        return true; // WNOHANG and nothing had changed state
+    }
+    if (!_has_result())
+    {
+        _correlate(tracer, tracee, retval);
+        return true;
+    }
     int status;
-    size_t retval;
-    if (!_get_result(tracee.pid, status, retval)) 
+    if (!_get_result(tracee, status)) 
     {
         return false;
     }
-    if ((pid_t)retval > 0 && (WIFEXITED(status) || WIFSIGNALED(status))) 
+    if (WIFEXITED(status) || WIFSIGNALED(status)) 
     {
         _on_success(tracer, tracee, retval);
     } 
-    else if ((pid_t)retval < 0) 
-    {
-        _on_failure(tracer, tracee, -(int)retval);
-    }
     return true;
 }
 
-bool WaitIDCall::finalise(Tracer& tracer, Tracee& tracee) 
+bool WaitIDCall::finalise(Tracer& tracer, Tracee& tracee, size_t retval) 
 {
+    if ((int)retval < 0) 
+    {
+        _on_failure(tracer, tracee, -(int)retval);
+        return true;
+    }
+    if (!_has_result())
+    {
+        _correlate(tracer, tracee, 0);
+        return true;
+    }
     siginfo_t info;
-    size_t retval;
-    if (!_get_result(tracee.pid, info, retval)) 
+    if (!_get_result(tracee, info)) 
     {
         return false;
     }
     // waitid will return 0 on success. However, this includes if WNOHANG was
     // specified and nothing happened, so we check info.si_pid to see if the
     // child actually changed state (we zero it out beforehand to be sure).
-    if (retval == 0 && info.si_pid != 0
+    // With WNOWAIT, the child is left as a zombie.
+    if (info.si_pid != 0 && !_has_flag(WNOWAIT)
         && (info.si_code == CLD_EXITED
         || info.si_code == CLD_KILLED
         || info.si_code == CLD_DUMPED)) 
     {
         _on_success(tracer, tracee, info.si_pid);
     } 
-    else if ((int)retval < 0) 
+    return true;
+}
+
+bool ForkCall::on_event(Tracer& tracer, Tracee& tracee, int status)
+{
+    if (!IS_FORK_EVENT(status) 
+        && !IS_CLONE_EVENT(status) 
+        && !IS_VFORK_EVENT(status))
     {
-        _on_failure(tracer, tracee, -(int)retval);
+        return BlockingCall::on_event(tracer, tracee, status);
+    }
+
+    unsigned long childId;
+    if (PTRACE(PTRACE_GETEVENTMSG, tracee.pid, 0, (void *)&childId) == -1) 
+    {
+        if (errno == ESRCH) 
+        {
+            return false;
+        }
+        throw SystemError(errno, "ptrace(PTRACE_GETEVENTMSG)");
+    }
+    _forked = true;
+    if (_vfork)
+    {
+        // We won't see the syscall-exit-stop until the child has execed or
+        // exited, so it can't be held back at the end of a step until then.
+        tracer._vforks++;
+    }
+
+    bool excluded = tracer._over_limits(tracee);
+    Process& process = tracee.process->tree().add(childId, *tracee.process);
+    Tracee& child = tracer._add_tracee(childId, &process);
+    child.attached = tracee.attached; // no seccomp filter to inherit
+    child.lifecycle = tracee.lifecycle;
+    child.throttled = tracee.throttled;
+    child.selected = tracee.selected;
+    if (child.lifecycle)
+    {
+        tracer._lifecycleTracees++;
+    }
+    child.depth = tracee.depth + 1;
+    tracee.process->notify_forked(process);
+    if (excluded)
+    {
+        tracer._exclude(child); // we'll let it go at its initial stop
     }
+    else
+    {
+        tracer._processes++;
+    }
+
+    // Our ptrace config causes SIGSTOP to be raised in the child after fork.
+    // Until we see that, the child is as good as running.
+    tracer._set_state(child, Tracee::RUNNING);
+    child.awaitingInitialStop = true;
+    tracer._claim_stops(childId);
     return true;
 }
 
-/* Call this when we've reached the syscall-exit-stop for a failed fork
- * call. If the fork failed due to the delivery of an interrupting signal,
- * then the failure will be ignored. For any other cause of failure, this 
- * function will exit the program - terminating all tracees (due to the
- * PTRACE_O_EXITKILL option). Leaves reseting tracee.syscall to the caller. */
-void Tracer::_handle_failed_fork(Tracee& tracee) 
+/* We've reached a syscall-exit-stop for the fork call. If the fork failed due
+ * to the delivery of an interrupting signal, then the failure will be ignored.
+ * For any other cause of failure, this function will exit the program - thus
+ * terminating all tracees (due to the PTRACE_O_EXITKILL option). */
+bool ForkCall::finalise(Tracer& tracer, Tracee& tracee, size_t retval)
 {
-    /* We've reached a syscall-exit-stop for the fork call, let's check the
-     * return value and determine the cause of failure. */
-    size_t retval;
-    if (!get_syscall_ret(tracee.pid, retval)) 
+    if (_forked)
     {
-        _expect_ended(tracee);
-        return;
+        _vfork_done(tracer);
+        // TODO what about INTR errors from fork? I guess it already succeeded.
+        return true;
     }
-    
+
     int err = -(long)retval;
     if (err == ERESTARTNOINTR)
     {
@@ -380,8 +659,7 @@ void Tracer::_handle_failed_fork(Tracee& tracee)
          * will then retry the fork when it next hits syscall-entry-stop, in
          * which case we'll get another go at this. */
         log("{} fork interrupted (to be resumed)", tracee.pid);
-        _resume(tracee);
-        return;
+        return true;
     }
 
     /* If the fork failed due to any other reason than an interrupting signal,
@@ -394,65 +672,132 @@ void Tracer::_handle_failed_fork(Tracee& tracee)
     _exit(1);
 }
 
-/* Also called for fork-like clones. Doesn't work with vfork yet :-( */
-void Tracer::_handle_fork(Tracee& tracee) 
+void ForkCall::on_ended(Tracer& tracer, Tracee& tracee, int status)
 {
-    int status;
-    if (!_resume(tracee) || !_wait_for_stop(tracee, status))
+    if (_forked)
     {
-        return;
+        _vfork_done(tracer); // killed while waiting for the child
+    }
+}
+
+void ForkCall::_vfork_done(Tracer& tracer)
+{
+    if (_vfork)
+    {
+        tracer._vforks--;
+        _vfork = false; // only once
     }
+}
 
-    if (!IS_FORK_EVENT(status)) 
+bool ThreadCall::on_event(Tracer& tracer, Tracee& tracee, int status)
+{
+    if (!IS_CLONE_EVENT(status))
     {
-        if (!IS_SYSCALL_EVENT(status)) 
-        {
-            throw diagnose_bad_event(tracee, status,
-                "Expected syscall-exit-stop after bad fork.");
-        }
-        tracee.syscall = SYSCALL_NONE;
-        _handle_failed_fork(tracee);
-        return;
+        return BlockingCall::on_event(tracer, tracee, status);
     }
 
-    unsigned long childId;
-    if (ptrace(PTRACE_GETEVENTMSG, tracee.pid, 0, (void *)&childId) == -1) 
+    unsigned long threadId;
+    if (PTRACE(PTRACE_GETEVENTMSG, tracee.pid, 0, (void *)&threadId) == -1) 
     {
         if (errno == ESRCH) 
         {
-            _expect_ended(tracee);
-            return;
+            return false;
         }
         throw SystemError(errno, "ptrace(PTRACE_GETEVENTMSG)");
     }
 
-    auto process = std::make_shared<Process>(childId, tracee.process);
-    Tracee& child = _add_tracee(childId, process); // will be in stopped state
-    tracee.process->notify_forked(process);
+    Tracee& thread = tracer._add_tracee(threadId, tracee.process);
+    thread.tgid = tracee.tgid;
+    thread.attached = tracee.attached;
+    thread.lifecycle = tracee.lifecycle;
+    thread.throttled = tracee.throttled;
+    thread.selected = tracee.selected;
+    if (thread.lifecycle)
+    {
+        tracer._lifecycleTracees++;
+    }
+    thread.depth = tracee.depth;
+    tracer._threads++;
+    verbose("{} created thread {}", tracee.tgid, threadId);
 
-    // Our ptrace config causes SIGSTOP to be raised in the child after fork
-    if (!_wait_for_stop(child, status))
+    // New threads get a SIGSTOP too, just like a forked child.
+    tracer._set_state(thread, Tracee::RUNNING);
+    thread.awaitingInitialStop = true;
+    tracer._claim_stops(threadId);
+    return true;
+}
+
+bool ThreadCall::finalise(Tracer& tracer, Tracee& tracee, size_t retval)
+{
+    // If it failed, then there isn't anything to clean up (and unlike a fork,
+    // it's not our job to protect anyone from thread-bombing themselves).
+    return true;
+}
+
+bool ExecveCall::on_event(Tracer& tracer, Tracee& tracee, int status)
+{
+    if (!IS_EXEC_EVENT(status))
     {
-        return;
+        return BlockingCall::on_event(tracer, tracee, status);
     }
-    if (WSTOPSIG(status) != SIGSTOP)
+    // The tracee has a brand new address space now.
+    tracee.memory.reset();
+    _execed = true;
+    return true;
+}
+
+bool ExecveCall::finalise(Tracer& tracer, Tracee& tracee, size_t retval)
+{
+    if (!_execed)
     {
-        throw diagnose_bad_event(child, status, 
-            "Expected SIGSTOP after fork.");
+        // Exec has failed!!! The return value tells us why.
+        int err = (long)retval; // TODO why did I check >= 0 previously?
+        tracee.process->notify_exec(std::move(_file), std::move(_args), -err);
+        return true;
     }
 
-    // Resume parent until the syscall-exit-stop
-    if (!_resume(tracee) || !_wait_for_stop(tracee, status)) 
+    bool excluded = tracer._check_subtree(tracee, _args);
+    tracee.process->notify_exec(std::move(_file), std::move(_args), 0);
+    auto it = tracer._leaders.find(tracee.pid);
+    if (it != tracer._leaders.end())
     {
-        return;
+        it->second.execed = true;
     }
-    if (!IS_SYSCALL_EVENT(status)) 
+    if (excluded)
     {
-        // TODO what about INTR errors from fork? I guess it already succeeded.
-        throw diagnose_bad_event(tracee, status,
-            "Expected syscall-exit-stop after fork.");
+        tracer._exclude(tracee); // we'll let it go after the syscall-exit-stop
+    }
+    return true;
+}
+
+bool KillCall::finalise(Tracer& tracer, Tracee& tracee, size_t retval)
+{
+    if (_signal != 0 && retval == 0) 
+    {
+        // ignore no signal or a failed kill et al
+        tracer._on_sent_signal(tracee, _target, _signal, _toThread);
+        _sent = true;
+    }
+    return true;
+}
+
+void KillCall::on_ended(Tracer& tracer, Tracee& tracee, int status)
+{
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL
+        && (_target == 0 || _target == tracee.pid || _target == tracee.tgid
+            || _target == -tracee.tgid) 
+        && _signal == SIGKILL) 
+    {
+        // The tracee SIGKILL'ed themselves or their own process group, so
+        // it's still a valid kill() event even though we never reached a
+        // syscall-exit-stop. (Technically it's possible for the SIGKILL to
+        // have not originated from this kill call if another process sent
+        // SIGKILL within the tiiiiny time window between the start of the
+        // kill syscall and it actually killing the process, but this is
+        // good enough for me I think). Unfortunately, PTRACE_GETSIGINFO is
+        // of no use here, since it can't track SIGKILL'ed processes. TODO
+        tracer._on_sent_signal(tracee, _target, _signal, _toThread);
     }
-    tracee.syscall = SYSCALL_NONE;
 }
 
 void Tracer::_handle_exec(Tracee& tracee, const char* path, const char** argv) 
@@ -461,8 +806,8 @@ void Tracer::_handle_exec(Tracee& tracee, const char* path, const char** argv)
     string file;
     try 
     {
-        if (!copy_string_array_from_tracee(tracee.pid, argv, args)
-            || !copy_string_from_tracee(tracee.pid, path, file))
+        if (!tracee.memory.read_string_array(argv, args)
+            || !tracee.memory.read_string(path, file))
         {
             _expect_ended(tracee);
             return;
@@ -487,61 +832,22 @@ void Tracer::_handle_exec(Tracee& tracee, const char* path, const char** argv)
     file = escaped_string(file);
 
     // resume and expect the exec event if the exec succeeded
-    int status;
-    if (!_resume(tracee) || !_wait_for_stop(tracee, status)) 
-    {
-        return;
-    }
-    if (!IS_EXEC_EVENT(status)) 
-    {
-        // Exec has failed!!!
-        if (!IS_SYSCALL_EVENT(status)) 
-        {
-            throw diagnose_bad_event(tracee, status,
-                "Expected a syscall-exit-stop after failed exec.");
-        }
-        tracee.syscall = SYSCALL_NONE;
-
-        // Get the return value to diagnose the cause of failure.
-        size_t retval;
-        if (!get_syscall_ret(tracee.pid, retval)) 
-        {
-            _expect_ended(tracee);
-            return;
-        }
-
-        int err = (long)retval; // TODO why did I check >= 0 previously?
-        tracee.process->notify_exec(std::move(file), std::move(args), -err);
-        return;
-    }
-
-    if (!_resume(tracee) || !_wait_for_stop(tracee, status)) 
+    auto call = std::make_unique<ExecveCall>(std::move(file), std::move(args));
+    if (_initiate_call(tracee, std::move(call)))
     {
-        return;
-    }
-    if (!IS_SYSCALL_EVENT(status)) 
-    {
-        throw diagnose_bad_event(tracee, status,
-            "Expected syscall-exit-stop after exec.");
-    }
-    tracee.syscall = SYSCALL_NONE;
-    tracee.process->notify_exec(std::move(file), std::move(args), 0);
-
-    auto it = _leaders.find(tracee.pid);
-    if (it != _leaders.end())
-    {
-        it->second.execed = true;
+        _resume(tracee);
     }
 }
 
-void Tracer::_initiate_wait(Tracee& tracee, unique_ptr<BlockingCall> wait) 
+bool Tracer::_initiate_call(Tracee& tracee, unique_ptr<BlockingCall> call) 
 {
-    if (!wait->prepare(*this, tracee)) 
+    if (!call->prepare(*this, tracee)) 
     {
         _expect_ended(tracee);
-        return;
+        return false;
     }
-    tracee.blockingCall = std::move(wait);
+    _set_call(tracee, std::move(call));
+    return true;
 }
 
 void Tracer::_on_sent_signal(Tracee& tracee, 
@@ -549,83 +855,84 @@ void Tracer::_on_sent_signal(Tracee& tracee,
                             int signal, 
                             bool toThread)
 {
-    Process& source = *tracee.process.get();
+    Process& source = *tracee.process;
     Process* dest = nullptr;
     auto it = _tracees.find(target);
     if (it != _tracees.end())
     {
-        dest = it->second.process.get();
+        dest = it->second.process;
     }
     Process::notify_sent_signal(target, source, dest, signal, toThread);
 }
 
-/* For kill/tgkill/tkill */
-void Tracer::_handle_kill(Tracee& tracee, 
-                         pid_t target, 
-                         int signal, 
-                         bool toThread)
+/* Also called for fork-like clones. The rest is handled by ForkCall. */
+void Tracer::_handle_fork(Tracee& tracee, bool vfork)
 {
-    if (!_resume(tracee))
+    if (_initiate_call(tracee, std::make_unique<ForkCall>(vfork)))
     {
-        return;
+        _resume(tracee);
     }
+}
 
-    // we won't use the _wait_for_stop helper function here, since we need a bit
-    // more manual control to handle the case where the tracee SIGKILLs itself.
-    int status;
-    if (waitpid(tracee.pid, &status, 0) == -1) 
-    {
-        if (errno == ECHILD)
-        {
-            throw BadTraceError(tracee.pid, "Waited for tracee "
-                "(after it called kill et al), but it doesn't exist.");
-        }
-        throw SystemError(errno, "waitpid");
-    }
-    if (!WIFSTOPPED(status)) 
+/* For clone and clone3. New threads are handled by ThreadCall, and anything
+ * that makes a child which sends SIGCHLD when it dies is as good as a fork (or
+ * a vfork, if it has CLONE_VFORK - like posix_spawn). Anything else is still
+ * cancelled (the child would need __WCLONE to be waited for). */
+void Tracer::_handle_clone(Tracee& tracee, uint64_t flags, int exitSignal)
+{
+    if (IS_CLONE_A_THREAD(flags))
     {
-        if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL) 
-        {
-            throw BadTraceError(tracee.pid, 
-                "Expected tracee to have been SIGKILL'ed.");
-        }
-        if ((target == 0 || target == tracee.pid || target == -tracee.pid) 
-            && signal == SIGKILL) 
+        if (_initiate_call(tracee, std::make_unique<ThreadCall>()))
         {
-            // The tracee SIGKILL'ed themselves or their own process group, so
-            // it's still a valid kill() event even though we never reached a
-            // syscall-exit-stop. (Technically it's possible for the SIGKILL to
-            // have not originated from this kill call if another process sent
-            // SIGKILL within the tiiiiny time window between the start of the
-            // kill syscall and it actually killing the process, but this is
-            // good enough for me I think). Unfortunately, PTRACE_GETSIGINFO is
-            // of no use here, since it can't track SIGKILL'ed processes. TODO
-            _on_sent_signal(tracee, target, signal, toThread);
+            _resume(tracee);
         }
-        _handle_wait_notification(tracee, status);
-        assert(tracee.state == Tracee::DEAD);
         return;
     }
-    if (!IS_SYSCALL_EVENT(status)) 
+    if (exitSignal == SIGCHLD)
     {
-        throw diagnose_bad_event(tracee, status,
-            "Expected syscall-exit-stop after kill et al.");
-    }
-    tracee.state = Tracee::STOPPED; // have to manually do this
-    tracee.syscall = SYSCALL_NONE;
-
-    size_t retval;
-    if (!get_syscall_ret(tracee.pid, retval)) {
-        _expect_ended(tracee);
+        _handle_fork(tracee, IS_CLONE_A_VFORK(flags));
         return;
     }
+    error("Tracee {} tried to clone with unsupported flags {:#x}.", 
+        tracee.pid, flags);
+    set_syscall(tracee.pid, SYSCALL_NONE); // make the syscall fail
+    _resume(tracee);
+}
 
-    if (signal == 0 || retval != 0) 
+/* clone3 has its arguments in a struct in the tracee's memory. */
+void Tracer::_handle_clone3(Tracee& tracee, const void* args)
+{
+    Clone3Args clone = { };
+    try
     {
-        _resume(tracee); // ignore no signal or a failed kill et al
-        return;
+        if (!tracee.memory.read(&clone, args, sizeof(clone)))
+        {
+            _expect_ended(tracee);
+            return;
+        }
+    }
+    catch (const SystemError& e)
+    {
+        // Bad address, so it's going to fail either way.
+        if (e.code() != EFAULT && e.code() != EIO)
+        {
+            throw;
+        }
+    }
+    _handle_clone(tracee, clone.flags, (int)clone.exitSignal);
+}
+
+/* For kill/tgkill/tkill. The rest is handled by KillCall. */
+void Tracer::_handle_kill(Tracee& tracee, 
+                         pid_t target, 
+                         int signal, 
+                         bool toThread)
+{
+    auto call = std::make_unique<KillCall>(target, signal, toThread);
+    if (_initiate_call(tracee, std::move(call)))
+    {
+        _resume(tracee);
     }
-    _on_sent_signal(tracee, target, signal, toThread);
 }
 
 /* Handle a source location update from tracee using our fake syscall */
@@ -634,19 +941,25 @@ void Tracer::_handle_new_location(Tracee& tracee,
                                  const char* function, 
                                  const char* file) 
 {
-    SourceLocation location;
-    location.line = line;
-    if (!copy_string_from_tracee(tracee.pid, function, location.func)) 
+    // Both strings are usually in .rodata right next to each other, so we
+    // read them together so that it only costs us a single syscall.
+    vector<string> strings;
+    if (!tracee.memory.read_strings({ function, file }, strings)) 
     {
         _expect_ended(tracee);
         return;
     }
-    if (!copy_string_from_tracee(tracee.pid, file, location.file)) 
+    SourceLocation location;
+    location.line = line;
+    location.func = std::move(strings[0]);
+    location.file = std::move(strings[1]);
+    tracee.process->update_location(std::move(location));
+    if (_seccomp && !tracee.attached)
     {
-        _expect_ended(tracee);
-        return;
+        // Our fake syscall just fails with ENOSYS, so there's no need to stop
+        // again at its exit if we don't have to (see _resume).
+        tracee.syscall = SYSCALL_NONE;
     }
-    tracee.process->update_location(std::move(location));
     _resume(tracee); // continue until syscall-exit-stop
 }
 
@@ -658,14 +971,26 @@ void Tracer::_handle_syscall_entry(Tracee& tracee,
     verbose("{} entered syscall {}", tracee.pid, get_syscall_name(syscall));
     switch (syscall) 
     {
-        case SYSCALL_PTRACE:
         case SYSCALL_SETPGID:
         case SYSCALL_SETSID:
-        case SYSCALL_VFORK:
+            if (tracee.attached)
+            {
+                // We only need these blocked so that nuke() can kill all of
+                // the leaders' process groups. It leaves attached trees alone.
+                _resume(tracee);
+                return;
+            }
+            break;
+
+        case SYSCALL_PTRACE:
             break; // we'll block these syscalls
 
         case SYSCALL_FORK:
-            _handle_fork(tracee);
+            _handle_fork(tracee, false);
+            return;
+
+        case SYSCALL_VFORK:
+            _handle_fork(tracee, true);
             return;
 
         case SYSCALL_EXECVE:
@@ -677,7 +1002,7 @@ void Tracer::_handle_syscall_entry(Tracee& tracee,
             return;
 
         case SYSCALL_WAIT4:
-            _initiate_wait(tracee, std::make_unique<Wait4Call>(
+            _initiate_call(tracee, std::make_unique<Wait4Call>(
                 (pid_t)args[0],
                 (int*)args[1],
                 (int)args[2]
@@ -685,7 +1010,7 @@ void Tracer::_handle_syscall_entry(Tracee& tracee,
             return;
 
         case SYSCALL_WAITID:
-            _initiate_wait(tracee, std::make_unique<WaitIDCall>(
+            _initiate_call(tracee, std::make_unique<WaitIDCall>(
                 (idtype_t)args[0],
                 (id_t)args[1],
                 (siginfo_t*)args[2],
@@ -694,14 +1019,15 @@ void Tracer::_handle_syscall_entry(Tracee& tracee,
             return;
 
         case SYSCALL_CLONE:
-            // TODO what if CLONE_THREAD or CLONE_PARENT is specified???
-            // Then that is very much *unlike* a fork...?!?!?!
-            if (IS_CLONE_LIKE_A_FORK(args)) 
-            {
-                _handle_fork(tracee);
-                return;
-            } 
-            break; // we'll cancel the syscall
+            // TODO what if CLONE_PARENT is specified???
+            _handle_clone(tracee, 
+                GET_CLONE_FLAGS(args), 
+                GET_CLONE_EXIT_SIGNAL(args));
+            return;
+
+        case SYSCALL_CLONE3:
+            _handle_clone3(tracee, (const void*)args[0]);
+            return;
 
         case SYSCALL_KILL: 
             _handle_kill(tracee, (pid_t)args[0], (int)args[1], false);
@@ -735,28 +1061,39 @@ void Tracer::_handle_syscall_entry(Tracee& tracee,
     _resume(tracee);
 }
 
-void Tracer::_handle_syscall_exit(Tracee& tracee)
+void Tracer::_handle_syscall_exit(Tracee& tracee, size_t retval)
 {
+    bool keepStopped = false;
     if (tracee.blockingCall != nullptr) 
     {
-        // we just reached the syscall-exit-stop for a blocking system
-        // call that we were trying to keep track of - so finish that.
-        if (!tracee.blockingCall->finalise(*this, tracee)) 
+        // we just reached the syscall-exit-stop for a system call that we
+        // were trying to keep track of - so finish that.
+        if (!tracee.blockingCall->finalise(*this, tracee, retval)) 
         {
             _expect_ended(tracee);
             return;
         }
-        verbose("{} exited blocking syscall {}", 
-            tracee.pid, get_syscall_name(tracee.syscall));
-        tracee.blockingCall.reset();
+        verbose("{} exited {}syscall {}", tracee.pid, 
+            tracee.blockingCall->blocking() ? "blocking " : "",
+            get_syscall_name(tracee.syscall));
+        keepStopped = tracee.blockingCall->keep_stopped();
+        _set_call(tracee, nullptr);
     }
     else
     {
         verbose("{} exited syscall {}", 
             tracee.pid, get_syscall_name(tracee.syscall));
     }
-    _resume(tracee);
-    tracee.syscall = SYSCALL_NONE;
+    tracee.syscall = SYSCALL_NONE; // before resuming (see _resume)
+    if (tracee.excluded)
+    {
+        _release(tracee); // see ExecveCall::finalise
+        return;
+    }
+    if (!keepStopped || !_can_hold_stops())
+    {
+        _resume(tracee);
+    }
 }
 
 void Tracer::_handle_signal_stop(Tracee& tracee, int signal)
@@ -779,7 +1116,7 @@ void Tracer::_handle_signal_stop(Tracee& tracee, int signal)
     }
 
     siginfo_t info;
-    if (ptrace(PTRACE_GETSIGINFO, tracee.pid, 0, &info) == -1)
+    if (PTRACE(PTRACE_GETSIGINFO, tracee.pid, 0, &info) == -1)
     {
         if (errno == ESRCH)
         {
@@ -791,37 +1128,240 @@ void Tracer::_handle_signal_stop(Tracee& tracee, int signal)
 
     tracee.process->notify_signaled(info.si_pid, signal);
     tracee.signal = signal; // make sure it's delivered when next resumed
+    if (!_can_hold_stops())
+    {
+        _resume(tracee);
+    }
 }
 
-void Tracer::_handle_stopped(Tracee& tracee, int status)
+/* An exec from any thread other than the thread group leader kills off all the
+ * other threads, and then the execing thread takes over the leader's ID. The
+ * exec event is reported for the leader's ID, so we move the exec call (and
+ * everything else) from the thread's Tracee to the leader's. The thread's old
+ * ID just disappears without any exit notifications (and so does the leader
+ * unless it had already exited - see ptrace(2)). Returns false if the tracee
+ * doesn't exist anymore. */
+bool Tracer::_handle_exec_event(Tracee& leader)
 {
-    assert(WIFSTOPPED(status));
-    if (IS_SYSCALL_EVENT(status))
+    unsigned long formerId;
+    if (PTRACE(PTRACE_GETEVENTMSG, leader.pid, 0, (void *)&formerId) == -1) 
+    {
+        if (errno == ESRCH) 
+        {
+            return false;
+        }
+        throw SystemError(errno, "ptrace(PTRACE_GETEVENTMSG)");
+    }
+    if ((pid_t)formerId == leader.pid)
+    {
+        return true; // the leader did it (the usual case)
+    }
+    auto it = _tracees.find(formerId);
+    if (it == _tracees.end() || it->second.tgid != leader.pid)
+    {
+        throw BadTraceError(leader.pid, fmt::format(
+            "Exec event from unknown thread {}.", formerId));
+    }
+    Tracee& thread = it->second;
+    verbose("{} execed from thread {}", leader.pid, thread.pid);
+
+    if (leader.blockingCall != nullptr)
+    {
+        // The leader was in the middle of something, but it's gone now.
+        debug("{} dropping call to {} (leader replaced by exec)", 
+              leader.pid, get_syscall_name(leader.syscall));
+    }
+    leader.syscall = thread.syscall;
+    leader.signal = 0;
+    _set_call(leader, _set_call(thread, nullptr));
+    _remove_tracee(thread);
+    return true;
+}
+
+/* Handles a fork, clone or exec event from a lifecycle tracee (see Options::
+ * lifecycle). We never saw the syscall that caused it, so we make up the call
+ * that its syscall-entry-stop would've started, and then finish it straight
+ * away (as if it had already reached the syscall-exit-stop). Returns false if
+ * the tracee doesn't exist anymore. */
+bool Tracer::_handle_lifecycle_event(Tracee& tracee, int status)
+{
+    unique_ptr<BlockingCall> call;
+    if (IS_EXEC_EVENT(status))
+    {
+        // The new program's arguments are already in place by now.
+        vector<string> args;
+        if (!get_cmdline(tracee.pid, args))
+        {
+            return false;
+        }
+        string file = args.empty() ? string() : args[0];
+        call = std::make_unique<ExecveCall>(std::move(file), std::move(args));
+    }
+    else if (IS_CLONE_EVENT(status))
     {
-        if (tracee.syscall == SYSCALL_NONE)
+        // We don't know the clone flags, so we ask the new task instead. It
+        // can't disappear on us, since we haven't seen it end yet.
+        unsigned long id;
+        if (PTRACE(PTRACE_GETEVENTMSG, tracee.pid, 0, (void *)&id) == -1) 
         {
-            int syscall;
-            size_t args[SYS_ARG_MAX];
-            if (!which_syscall(tracee.pid, syscall, args))
+            if (errno == ESRCH) 
             {
-                _expect_ended(tracee);
-                return;
+                return false;
             }
-            _handle_syscall_entry(tracee, syscall, args);
+            throw SystemError(errno, "ptrace(PTRACE_GETEVENTMSG)");
+        }
+        pid_t tgid;
+        if (get_tgid(id, tgid) && tgid == tracee.tgid)
+        {
+            call = std::make_unique<ThreadCall>();
         }
         else
         {
-            _handle_syscall_exit(tracee); // resets to SYSCALL_NONE for us
+            call = std::make_unique<ForkCall>(false);
+        }
+    }
+    else
+    {
+        // (A vfork's parent won't be held back, see _can_hold_stops.)
+        call = std::make_unique<ForkCall>(false);
+    }
+    return call->on_event(*this, tracee, status) 
+        && call->finalise(*this, tracee, 0);
+}
+
+void Tracer::_handle_stopped(Tracee& tracee, int status)
+{
+    assert(WIFSTOPPED(status));
+    if (tracee.throttled && !tracee.lifecycle
+        && tracee.syscall == SYSCALL_NONE)
+    {
+        // It's not in the middle of anything, so it's safe to switch it over
+        // now (it keeps `throttled` set since it still has our filter).
+        tracee.lifecycle = true;
+        _lifecycleTracees++;
+        verbose("{} switched to lifecycle tracing", tracee.pid);
+
+        // We won't see it reap the children that have already ended either.
+        ProcessTree& tree = tracee.process->tree();
+        for (ProcessId id : tracee.process->unreaped_children())
+        {
+            Process& child = tree.get(id);
+            auto it = _tracees.find(child.pid());
+            if (it == _tracees.end() || it->second.process != &child
+                || it->second.state != Tracee::DEAD || it->second.lifecycle)
+            {
+                continue; // (lifecycle ones are on _unreaped already)
+            }
+            auto listed = std::find_if(_unreaped.begin(), _unreaped.end(),
+                [&](auto& pair) { return pair.first == child.pid(); });
+            if (listed == _unreaped.end())
+            {
+                _unreaped.emplace_back(child.pid(), 
+                    std::chrono::steady_clock::time_point());
+            }
+        }
+    }
+    if (IS_SYSCALL_EVENT(status) || IS_SECCOMP_EVENT(status))
+    {
+        if (tracee.lifecycle)
+        {
+            // It was switched over (see _throttle), but it still has our
+            // seccomp filter (or we just switched it above).
+            _resume(tracee);
+            return;
+        }
+        // We only have to guess whether it's an entry or an exit if the kernel
+        // is too old to tell us (see get_syscall_stop).
+        SyscallStop stop;
+        SyscallStop::Op expected = IS_SECCOMP_EVENT(status) 
+            ? SyscallStop::SECCOMP 
+            : (tracee.syscall == SYSCALL_NONE 
+                ? SyscallStop::ENTRY : SyscallStop::EXIT);
+        if (!get_syscall_stop(tracee.pid, expected, stop))
+        {
+            _expect_ended(tracee);
+            return;
+        }
+        switch (stop.op)
+        {
+            case SyscallStop::ENTRY:
+            case SyscallStop::SECCOMP:
+                // The seccomp filter stops us at the entry to syscalls we care
+                // about (it's a separate stop to the syscall-entry-stop, which
+                // we skip when using the filter).
+                if (tracee.syscall != SYSCALL_NONE)
+                {
+                    throw diagnose_bad_event(tracee, status,
+                        "Got syscall entry while already in a syscall.");
+                }
+                _handle_syscall_entry(tracee, stop.syscall, stop.args);
+                if (tracee.state == Tracee::STOPPED && !_can_hold_stops())
+                {
+                    _resume(tracee); // e.g., a wait that was held for a step
+                }
+                break;
+            case SyscallStop::EXIT:
+                if (tracee.syscall == SYSCALL_NONE)
+                {
+                    throw diagnose_bad_event(tracee, status,
+                        "Got syscall exit without a syscall entry.");
+                }
+                // resets to SYSCALL_NONE for us
+                _handle_syscall_exit(tracee, stop.retval);
+                break;
+            default:
+                throw diagnose_bad_event(tracee, status,
+                    "Kernel says that this isn't a syscall-stop.");
         }
     }
     else if (IS_FORK_EVENT(status) 
+        || IS_VFORK_EVENT(status)
         || IS_CLONE_EVENT(status) 
         || IS_EXEC_EVENT(status)
         || IS_EXIT_EVENT(status))
     {
-        // These events should only be generated when handling the respective
-        // system calls. They should not be appearing now.
-        throw diagnose_bad_event(tracee, status, "Got event at weird time.");
+        // These events should only be generated in the middle of the syscalls
+        // that cause them, so let the call that we're tracking handle it.
+        if (IS_EXEC_EVENT(status) && !_handle_exec_event(tracee))
+        {
+            _expect_ended(tracee);
+            return;
+        }
+        if (tracee.lifecycle && tracee.blockingCall == nullptr)
+        {
+            // Unless we've only got the events to go on.
+            if (!_handle_lifecycle_event(tracee, status))
+            {
+                _expect_ended(tracee);
+            }
+            else if (tracee.excluded)
+            {
+                _release(tracee); // see ExecveCall::finalise
+            }
+            else
+            {
+                _resume(tracee);
+            }
+            return;
+        }
+        if (tracee.blockingCall == nullptr)
+        {
+            throw diagnose_bad_event(tracee, status, "Got event at weird time.");
+        }
+        if (!tracee.blockingCall->on_event(*this, tracee, status))
+        {
+            _expect_ended(tracee);
+            return;
+        }
+        _resume(tracee); // continue until the syscall-exit-stop
+    }
+    else if (IS_STOP_EVENT(status))
+    {
+        // Only tracees that we attached to (and their children) give us these,
+        // since we had to PTRACE_SEIZE them (see attach). This is either a
+        // group-stop or the end of one. We don't do job control, so just keep
+        // it going (the stop signal itself was already reported).
+        _resume(tracee);
     }
     else
     {
@@ -829,30 +1369,96 @@ void Tracer::_handle_stopped(Tracee& tracee, int status)
     }
 }
 
+/* Works out what kind of stop the wait status is for (see stats.hpp). This has
+ * to be called before the tracee's syscall gets updated for the stop. */
+static Stop stop_kind(const Tracee& tracee, int status)
+{
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        return Stop::END;
+    }
+    if (IS_SYSCALL_EVENT(status))
+    {
+        return tracee.syscall == SYSCALL_NONE
+            ? Stop::SYSCALL_ENTRY : Stop::SYSCALL_EXIT;
+    }
+    if (IS_SECCOMP_EVENT(status))
+    {
+        return Stop::SECCOMP;
+    }
+    return (status >> 16) != 0 ? Stop::EVENT : Stop::SIGNAL;
+}
+
 void Tracer::_handle_wait_notification(Tracee& tracee, int status)
 {
+    count_stop(stop_kind(tracee, status));
+    if (tracee.excluded)
+    {
+        _handle_excluded(tracee, status);
+        return;
+    }
     if (tracee.state == Tracee::DEAD)
     {
+        if (_subreaper && (WIFEXITED(status) || WIFSIGNALED(status)))
+        {
+            // Its parent died before reaping it, so it got passed on to us 
+            // (see _check_reaped), and we just reaped it.
+            _orphan(tracee, _our_reap(tracee));
+            return;
+        }
         throw diagnose_bad_event(tracee, status, "Got event for dead tracee.");
     }
     if (WIFEXITED(status) || WIFSIGNALED(status))
     {
+        if (tracee.blockingCall != nullptr)
+        {
+            tracee.blockingCall->on_ended(*this, tracee, status);
+            _set_call(tracee, nullptr);
+        }
+        if (tracee.pid != tracee.tgid)
+        {
+            // Just one of the threads. Nobody can reap a thread, so we're the
+            // last to hear about it. The process only ends with the leader,
+            // which the kernel doesn't report until the other threads are done.
+            verbose("{} thread {} ended", tracee.tgid, tracee.pid);
+            _remove_tracee(tracee);
+            return;
+        }
         tracee.process->notify_ended(status);
         if (_leaders.find(tracee.pid) != _leaders.end())
         {
             log("leader {} ended", tracee.pid);
             // Also, since we're the parent of this proces, this ptrace
             // notification doubles up as us reaping it, so we can remove it.
-            _tracees.erase(tracee.pid);
+            _remove_tracee(tracee);
             // We don't want to reset _leader since we want to keep the PID
             // around since it doubles up as the PGID (for easy killing), so
             // we'll just _leader set.
         }
+        else if (tracee.attached)
+        {
+            _handle_attached_end(tracee);
+        }
         else
         {
             // We don't want to erase the tracee from our list until we've been
             // told that it was orphaned or reaped. So remember this for later.
-            tracee.state = Tracee::DEAD;
+            _set_state(tracee, Tracee::DEAD);
+            auto parent = tracee.process->parent();
+            auto parentIt = parent 
+                ? _tracees.find(parent->pid()) : _tracees.end();
+            if (tracee.lifecycle || (parentIt != _tracees.end() 
+                && parentIt->second.process == parent
+                && parentIt->second.lifecycle))
+            {
+                // We won't see its parent reap it (see _infer_reaps).
+                _unreaped.emplace_back(tracee.pid, 
+                    std::chrono::steady_clock::time_point());
+            }
+            if (_subreaper)
+            {
+                _check_reaped(tracee);
+            }
         }
         return;
     }
@@ -862,7 +1468,33 @@ void Tracer::_handle_wait_notification(Tracee& tracee, int status)
         throw diagnose_bad_event(tracee, status,
             "Tracee hasn't ended but also hasn't stopped...");
     }
-    tracee.state = Tracee::STOPPED;
+    _set_state(tracee, Tracee::STOPPED);
+    _meter_stop(tracee);
+    if (tracee.awaitingInitialStop)
+    {
+        // Our ptrace config causes SIGSTOP to be raised in the child after
+        // fork (or a PTRACE_EVENT_STOP if the parent was PTRACE_SEIZE'd).
+        // We'll leave it stopped there until the next step.
+        if (WSTOPSIG(status) != SIGSTOP && !IS_STOP_EVENT(status))
+        {
+            throw diagnose_bad_event(tracee, status, 
+                "Expected SIGSTOP after fork.");
+        }
+        tracee.awaitingInitialStop = false;
+        if (tracee.pid != tracee.tgid)
+        {
+            // A new thread. The rest of its thread group could be waiting on
+            // it in ways that we don't see (pthread_join is just a futex), so
+            // it can't sit around until the next step.
+            _resume(tracee);
+            return;
+        }
+        if (!_can_hold_stops())
+        {
+            _resume(tracee);
+        }
+        return;
+    }
     _handle_stopped(tracee, status);
 }
 
@@ -870,26 +1502,6 @@ void Tracer::_handle_wait_notification(Tracee& tracee, int status)
  * HELPER FUNCTIONS FOR TRACING
  *****************************************************************************/
 
-bool Tracer::_wait_for_stop(Tracee& tracee, int& status)
-{
-    if (waitpid(tracee.pid, &status, 0) == -1) 
-    {
-        if (errno == ECHILD)
-        {
-            throw BadTraceError(tracee.pid, 
-                "Waited for tracee to stop but it doesn't exist.");
-        }
-        throw SystemError(errno, "waitpid");
-    }
-    if (WIFSTOPPED(status)) 
-    {
-        tracee.state = Tracee::STOPPED;
-        return true;
-    }
-    _handle_wait_notification(tracee, status);
-    return false;
-}
-
 bool Tracer::_resume(Tracee& tracee)
 {
     if (tracee.state != Tracee::STOPPED)
@@ -897,7 +1509,14 @@ bool Tracer::_resume(Tracee& tracee)
         debug("{} not stopped, so not resuming it.", tracee.pid);
         return true; // TODO why would this happen? Should it happen?
     }
-    bool ok = resume_tracee(tracee.pid, tracee.signal);
+    // When using the seccomp filter, we only need syscall-stops if we're in
+    // the middle of a syscall that we want to see the exit of. Otherwise, the
+    // filter will stop the tracee at the next syscall that we're interested in.
+    // Tracees that we attached to don't have the filter though. Lifecycle
+    // tracees don't have it either, but they never need syscall-stops.
+    bool syscallStop = !tracee.lifecycle && (!_seccomp || tracee.attached 
+        || tracee.syscall != SYSCALL_NONE);
+    bool ok = resume_tracee(tracee.pid, tracee.signal, syscallStop);
     if (!ok)
     {
         debug("resume_tracee({}) failed", tracee.pid);
@@ -907,205 +1526,980 @@ bool Tracer::_resume(Tracee& tracee)
         debug("resumed tracee {}", tracee.pid);
     }
     tracee.signal = 0;
-    tracee.state = Tracee::RUNNING;
+    _set_state(tracee, Tracee::RUNNING);
     return ok;
 }
 
 
-/* Calls waitpid on the tracee and makes sure that it's either exited or been
- * killed, then handles the exit/kill event with _handle_wait_notification. 
- * If the tracee hasn't ended, then a BadTraceError is thrown. */
+/* Call this when the tracee has disappeared out from under us (i.e., we got
+ * ESRCH from ptrace). It must have been killed (e.g., by SIGKILL), so its exit
+ * status will turn up in the main wait loop in step() sooner or later - so we
+ * just consider it to be running until then. */
 void Tracer::_expect_ended(Tracee& tracee)
 {
-    // TODO maybe use WNOHANG? Maybe loop until we get an exit event in case
-    // multiple were queued up (is that even possible?). Grrr so much of this
-    // depends on me know the precise behaviour of Linux and sometimes the only
-    // solution is to either test it or read the source code.
-    int status;
-    if (waitpid(tracee.pid, &status, 0) == -1)
+    _set_state(tracee, Tracee::RUNNING);
+}
+
+/* Use this to change a tracee's state (see _running etc.). */
+void Tracer::_set_state(Tracee& tracee, Tracee::State state)
+{
+    if (state == Tracee::STOPPED && tracee.state != Tracee::STOPPED)
     {
-        if (errno == ECHILD)
-        {
-            throw BadTraceError(tracee.pid, 
-                "Expected tracee to have ended but it doesn't exist.");
-        }
-        throw SystemError(errno, "waitpid");
+        tracee.stoppedAt = std::chrono::steady_clock::now();
     }
-    if (!WIFEXITED(status) && !WIFSIGNALED(status))
+    else if (state != Tracee::STOPPED && tracee.state == Tracee::STOPPED
+        && tracee.stoppedAt != std::chrono::steady_clock::time_point())
     {
-        throw diagnose_bad_event(tracee, status,
-            "Expected tracee to have ended, but it hasn't.");
+        record_stop_time(std::chrono::steady_clock::now() - tracee.stoppedAt);
+        tracee.stoppedAt = std::chrono::steady_clock::time_point();
     }
-
-    // this will handle the event for us and set tracee's state to DEAD
-    _handle_wait_notification(tracee, status);
+    _count(tracee, -1);
+    tracee.state = state;
+    _count(tracee, +1);
 }
 
-/******************************************************************************
- * OTHER METHODS
- *****************************************************************************/
+/* Use this to change a tracee's BlockingCall (see _blocked). Gives back the
+ * call that it had before. */
+unique_ptr<BlockingCall> Tracer::_set_call(Tracee& tracee, 
+                                           unique_ptr<BlockingCall> call)
+{
+    _count(tracee, -1);
+    std::swap(tracee.blockingCall, call);
+    _count(tracee, +1);
+    return call; // the old one
+}
 
-void Tracer::_collect_orphans() 
+/* Adds (delta = +1) or removes (delta = -1) the tracee to/from the counters of
+ * the tracees in each state. */
+void Tracer::_count(const Tracee& tracee, int delta)
 {
-    while (!_orphans.empty())
+    if (tracee.state == Tracee::DEAD)
     {
-        pid_t pid = _orphans.front();
-        _orphans.pop();
-
-        auto it = std::find(_recycledPIDs.begin(), _recycledPIDs.end(), pid);
-        if (it != _recycledPIDs.end())
-        {
-            _recycledPIDs.erase(it); // we already removed it
-            continue;
-        }
-
-        auto pair = _tracees.find(pid);
-        if (pair == _tracees.end())
-        {
-            warning("Unknown PID {} was orphaned", pid);
-            continue;
-        }
-        if (pair->second.state != Tracee::DEAD)
+        _dead += delta;
+    }
+    else if (tracee.state == Tracee::RUNNING)
+    {
+        _running += delta;
+        // Excluded tracees could run for as long as they like, and we aren't
+        // going to stop them at the end of a step, so they count as blocked.
+        if ((tracee.blockingCall && tracee.blockingCall->blocking())
+            || tracee.excluded)
         {
-            throw BadTraceError(pid, "An alive tracee was orphaned.");
+            _blocked += delta;
         }
-
-        log("{} orphaned", pid);
-        pair->second.process->notify_orphaned();
-        _tracees.erase(pair);
     }
 }
 
-shared_ptr<Process> Tracer::start(string_view program, vector<string> argv) 
-{
-    std::scoped_lock<std::mutex> guard(_lock);
-
-    pid_t pid = start_tracee(program, argv); // may throw
-    auto process = std::make_shared<Process>(pid, program, argv);
-    Leader& leader = _leaders[pid] = Leader();
-    _add_tracee(pid, process);
+/******************************************************************************
+ * OTHER METHODS
+ *****************************************************************************/
 
-    while (!leader.execed)
+/* Only used in subreaper mode, once we've got the exit status of a tracee that
+ * isn't a leader. If its parent died first, then the tracee was passed on to
+ * us, so we've just reaped it as well. If not, then it's a zombie now, and its
+ * parent will reap it (or else it'll be passed on to us later, and we'll get
+ * its exit status again). We can't tell which from the fact that it's gone,
+ * since the parent could've reaped it straight after we got the exit status,
+ * so we put off deciding until its parent is dead too (see _collect_orphans).
+ * If its parent did reap it, then we'll find that out before then. */
+void Tracer::_check_reaped(Tracee& tracee)
+{
+    if (!is_zombie(tracee.pid))
     {
-        // Search the map each time since it is possible that the leader has 
-        // ended and been removed and old references invalidated.
-        auto it = _tracees.find(pid);
-        if (it == _tracees.end())
-        {
-            throw std::runtime_error("Tracee ended before it could exec.");
-        }
-        if (!_resume(it->second))
-        {
-            _expect_ended(it->second);
-            throw std::runtime_error("Tracee failed to exec.");
-        }
-        int status;
-        if (waitpid(pid, &status, 0) == -1)
-        {
-            throw SystemError(errno, "waitpid");
-        }
-        _handle_wait_notification(it->second, status);
+        _vanished.push_back(tracee.pid);
     }
-
-    return process;
 }
 
-bool Tracer::_all_tracees_dead() const
+/* Only used in subreaper mode, once we know that we reaped the tracee
+ * ourselves. Gets what wait4 told us about it when we did (see wait_for_batch).
+ */
+std::optional<ReapInfo> Tracer::_our_reap(const Tracee& tracee) const
 {
-    for (auto& pair : _tracees)
+    auto it = _reaps.find(tracee.pid);
+    if (it == _reaps.end())
     {
-        if (pair.second.state != Tracee::DEAD)
-        {
-            return false; // TODO use counters instead?
-        }
+        return std::nullopt;
     }
-    return true;
+    ReapInfo info = it->second;
+    info.startTime = tracee.startTime;
+    return info;
 }
 
-bool Tracer::_are_tracees_running() const
+/* Only used in subreaper mode. Picks up the exit statuses of orphans that have
+ * been passed on to us after they ended (see _check_reaped), without blocking.
+ * We call this when we aren't going to wait for anything else. */
+void Tracer::_reap_orphans()
 {
-    for (auto& pair : _tracees)
+    vector<std::pair<pid_t, int>> batch;
+    vector<std::pair<pid_t, ReapInfo>> reaps;
+    if (!wait_for_batch(batch, __WALL | WNOHANG, &reaps))
     {
-        if (pair.second.state == Tracee::RUNNING)
+        if (errno != ECHILD)
         {
-            return true; // TODO use counters instead?
+            throw SystemError(errno, "wait4");
         }
+        return;
+    }
+    for (auto [pid, status] : batch)
+    {
+        _statuses.emplace(pid, status);
+    }
+    for (auto& [pid, info] : reaps)
+    {
+        _reaps[pid] = info;
     }
-    return false;
+    _handle_statuses();
+    _collect_orphans();
 }
 
-Tracee& Tracer::_add_tracee(pid_t pid, shared_ptr<Process> process)
+void Tracer::_collect_orphans() 
 {
-    auto old = _tracees.find(pid);
-    if (old != _tracees.end())
+    if (_orphansLost)
     {
-        // We got a new tracee with the same PID as an existing tracee. This is
-        // possible if the old tracee was orphaned and the reaper reaped it,
-        // but the system recycled the PID before we learnt about it. This is
-        // extremely unlikely to occur but why not be prepared for it.
-        _tracees.erase(old); // it ded
-        _recycledPIDs.push_back(pid);
+        throw std::runtime_error(*_orphansLost);
     }
-    auto [it, good] = _tracees.emplace(pid, Tracee(pid, std::move(process)));
-    assert(good); // good is true if the key was vacant
-    return it->second;
+    // See _check_reaped.
+    for (size_t i = 0; i < _vanished.size(); )
+    {
+        Tracee& tracee = _tracees.at(_vanished[i]);
+        auto parent = tracee.process->parent();
+        if (parent && !parent->dead())
+        {
+            ++i; // its parent could still be in the middle of reaping it
+            continue;
+        }
+        // Its parent ended without reaping it, so we must have reaped it.
+        _orphan(tracee, _our_reap(tracee)); // (removes it from _vanished)
+    }
+
+    while (!_orphans.empty())
+    {
+        auto [pid, info] = _orphans.front();
+        _orphans.pop();
+
+        auto it = _tracees.find(pid);
+        if (it == _tracees.end())
+        {
+            if (_detaches == 0 && _inferredReaps == 0)
+            {
+                warning("Unknown PID {} was orphaned", pid);
+            }
+            else
+            {
+                // Probably from a subtree that we left out (see _exclude), or
+                // one that we guessed wrong about (see _infer_reaps).
+                debug("Unknown PID {} was orphaned", pid);
+            }
+            continue;
+        }
+        Tracee& tracee = it->second;
+        if (tracee.excluded)
+        {
+            continue; // we'll drop it once we get its exit status
+        }
+        if (info.startTime != 0 && tracee.startTime != 0 
+            && info.startTime != tracee.startTime)
+        {
+            // We already got rid of the orphan when its PID got recycled (see
+            // _add_tracee), and this tracee is the new owner of the PID.
+            debug("{} was orphaned after its PID was recycled", pid);
+            continue;
+        }
+        if (tracee.state != Tracee::DEAD)
+        {
+            throw BadTraceError(pid, "An alive tracee was orphaned.");
+        }
+        _orphan(tracee, info);
+    }
+    _infer_reaps();
 }
 
-bool Tracer::step() 
+/* We never see the wait calls of lifecycle tracees (see Options::lifecycle),
+ * so this works out who reaped the ones that have ended from the order that
+ * things disappear in. If one disappears while its parent is still alive, then
+ * its parent must have reaped it. If its parent has ended as well, then it
+ * could've been orphaned instead, which we'll hear about in the usual way (see
+ * _orphan) - so we give that ORPHAN_GRACE to turn up before deciding that the
+ * parent reaped it just before it ended. Ones that are still zombies are left
+ * alone (whoever reaps them, we'll find out about it later). */
+void Tracer::_infer_reaps()
 {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < _unreaped.size(); )
     {
-        // We only want the mutex locked up until we wait() since the wait is
-        // a blocking call and we don't want to keep it locked unnecessarily.
-        std::scoped_lock<std::mutex> guard(_lock);
-        if (_tracees.empty())
+        auto& [pid, deadline] = _unreaped[i];
+        auto it = _tracees.find(pid);
+        if (it == _tracees.end() || it->second.state != Tracee::DEAD)
         {
-            return false; // no tracees left
+            // It was orphaned (or its PID was recycled after that).
+            _unreaped.erase(_unreaped.begin() + i);
+            continue;
         }
-        for (auto& [pid, tracee] : _tracees) 
+        Tracee& tracee = it->second;
+        auto parent = tracee.process->parent();
+        if (!parent || is_zombie(pid))
         {
-            _resume(tracee);
+            ++i;
+            continue;
         }
-        _collect_orphans();
+        auto parentIt = _tracees.find(parent->pid());
+        if (parentIt != _tracees.end() && !parentIt->second.lifecycle
+            && parentIt->second.process == parent)
+        {
+            // We'll see its parent's wait after all (see _throttle).
+            ++i;
+            continue;
+        }
+        // The parent has to be checked after the child, since it can only be
+        // orphaned once the parent has ended (which makes the parent a zombie
+        // until we've seen it end, since we trace it).
+        if (parent->dead() || is_zombie(parent->pid()))
+        {
+            if (deadline == std::chrono::steady_clock::time_point())
+            {
+                deadline = now + ORPHAN_GRACE;
+            }
+            if (now < deadline)
+            {
+                ++i;
+                continue;
+            }
+        }
+        debug("inferred that {} reaped {}", parent->pid(), pid);
+        parent->notify_inferred_reap(*tracee.process);
+        _inferredReaps++;
+        _unreaped.erase(_unreaped.begin() + i);
+        _remove_tracee(tracee);
     }
+}
 
-    // We only want to wait if we know there's something to wait for. If we're
-    // not careful with that, then we could end up blocking forever.
-    if (_are_tracees_running()) // FIXME: mutex should be locked?!
+/* Once a tracee in a tree that we attached to has ended. We aren't the
+ * subreaper for these, so nobody tells us when they get orphaned (they go off
+ * to whoever the subreaper is, or to init), and the root gets reaped by its
+ * parent outside of the trace. So we consider them to be orphaned as soon as
+ * they and their parent have both ended. */
+void Tracer::_handle_attached_end(Tracee& tracee)
+{
+    // (A copy, since _orphan takes them off the list.)
+    vector<ProcessId> zombies = tracee.process->unreaped_children();
+    for (ProcessId id : zombies)
+    {
+        Process& child = tracee.process->tree().get(id);
+        auto it = _tracees.find(child.pid());
+        if (it != _tracees.end() && it->second.process == &child
+            && it->second.attached && !it->second.excluded
+            && it->second.state == Tracee::DEAD)
+        {
+            _orphan(it->second, std::nullopt);
+        }
+    }
+
+    auto parent = tracee.process->parent();
+    if (!parent)
+    {
+        log("{} ended", tracee.pid);
+        _remove_tracee(tracee);
+    }
+    else if (parent->dead())
+    {
+        _orphan(tracee, std::nullopt);
+    }
+    else
+    {
+        _set_state(tracee, Tracee::DEAD); // until its parent reaps it
+    }
+}
+
+/* Should a new child of this tracee be left out of the trace because of the
+ * limits in the Options? */
+bool Tracer::_over_limits(const Tracee& parent) const
+{
+    return parent.depth + 1 > _maxDepth || _processes >= _maxProcesses;
+}
+
+/* Do these program arguments match Options::onlySubtree? */
+bool Tracer::_matches_subtree(const vector<string>& args) const
+{
+    return _onlySubtree && std::regex_search(join(args), *_onlySubtree);
+}
+
+/* Only does anything with Options::onlySubtree, once a tracee has execed. If 
+ * its new program matches, then the tracee is now at the top of a subtree that
+ * we're tracing. If not, and it isn't already in one of those, then we return
+ * true to say that it should be left out (see _exclude) - unless it's the
+ * root (which we always keep), or it has forked already (since we're still
+ * tracing those children). */
+bool Tracer::_check_subtree(Tracee& tracee, const vector<string>& args)
+{
+    if (!_onlySubtree || tracee.selected)
+    {
+        return false;
+    }
+    if (_matches_subtree(args))
+    {
+        verbose("{} matched, so we're tracing its subtree", tracee.pid);
+        tracee.selected = true;
+        return false;
+    }
+    return tracee.process->parent() != nullptr 
+        && !tracee.process->has_children();
+}
+
+/* Leaves a tracee out of the trace from now on, along with everything that it
+ * goes on to create. Its Process gets a DetachEvent, and we hang on to it so
+ * that its parent can still reap it (see WaitCall::_on_success). The tracee
+ * gets let go of as soon as it's stopped (see _release). */
+void Tracer::_exclude(Tracee& tracee)
+{
+    tracee.process->notify_detached();
+    _detached[tracee.pid] = { tracee.process, tracee.startTime };
+    _count(tracee, -1);
+    tracee.excluded = true;
+    _count(tracee, +1);
+    _detaches++;
+}
+
+/* Lets go of a stopped tracee that we've left out of the trace by detaching
+ * from it, so that it runs at full speed from then on. If it has our seccomp
+ * filter though, then it has to stay traced (see detach_tracee), so we just 
+ * keep it going instead (see _handle_excluded). That's still pretty cheap,
+ * since the filter only stops it for the syscalls that we care about. */
+void Tracer::_release(Tracee& tracee)
+{
+    if (_seccomp && !tracee.attached
+        && (!tracee.lifecycle || tracee.throttled))
+    {
+        _resume(tracee);
+        return;
+    }
+    if (!detach_tracee(tracee.pid))
+    {
+        _expect_ended(tracee);
+        return;
+    }
+    verbose("detached from {}", tracee.pid);
+    _remove_tracee(tracee);
+}
+
+/* Counts a stop against the tracee's process (the group leader stands in for
+ * a thread's process) and against its parent, so that a process's window 
+ * covers its own stops and those of its children. We don't go any further up
+ * than that, since that would mean a lookup for every ancestor on every stop,
+ * and anything with a busy subtree (like the root) would end up throttled. If
+ * either of them has stopped maxStopRate times within the last second, then 
+ * its whole subtree gets switched over to lifecycle tracing (see _throttle). */
+void Tracer::_meter_stop(Tracee& tracee)
+{
+    tracee.stops++;
+    if (_maxStopRate == 0 || tracee.lifecycle || tracee.throttled
+        || tracee.excluded)
+    {
+        return;
+    }
+    auto lookup = [&](pid_t pid, const Process* process) -> Tracee*
+    {
+        auto it = _tracees.find(pid);
+        if (it == _tracees.end() || it->second.process != process
+            || it->second.excluded)
+        {
+            return nullptr; // (or its PID was recycled)
+        }
+        return &it->second;
+    };
+    Process* parent = tracee.process->parent();
+    Tracee* metered[] = 
+    {
+        tracee.pid == tracee.tgid 
+            ? &tracee : lookup(tracee.tgid, tracee.process),
+        parent ? lookup(parent->pid(), parent) : nullptr,
+    };
+    auto now = std::chrono::steady_clock::now();
+    for (Tracee* cur : metered)
+    {
+        if (!cur)
+        {
+            continue;
+        }
+        if (cur->windowStops++ == 0
+            || now - cur->windowStart >= std::chrono::seconds(1))
+        {
+            cur->windowStart = now;
+            cur->windowStops = 1;
+        }
+        else if (cur->windowStops >= _maxStopRate)
+        {
+            std::chrono::duration<double> elapsed = now - cur->windowStart;
+            double secs = std::max(elapsed.count(), 0.001);
+            _throttle(*cur, cur->windowStops / secs);
+            return;
+        }
+    }
+}
+
+/* Switches everything in the subtree of a tracee over to lifecycle tracing,
+ * because it's been stopping so often that tracing it properly would slow it
+ * down too much. Each of them actually gets switched the next time it stops
+ * outside of a syscall (see _handle_stopped), and anything they create later on
+ * inherits it. */
+void Tracer::_throttle(Tracee& root, size_t rate)
+{
+    Process* target = root.process;
+    if (!target->dead())
+    {
+        target->notify_downgraded(rate);
+    }
+    for (auto& [pid, tracee] : _tracees)
+    {
+        if (tracee.lifecycle || tracee.excluded)
+        {
+            continue; // these don't stop for syscalls anyway
+        }
+        for (Process* p = tracee.process; p; p = p->parent())
+        {
+            if (p == target)
+            {
+                tracee.throttled = true;
+                break;
+            }
+        }
+    }
+    verbose("throttled the subtree of {} ({} stops/s)", root.pid, rate);
+}
+
+/* Handles a wait status of a tracee that we couldn't detach from after leaving
+ * it out of the trace (see _release). We don't record anything, we just keep
+ * it going, and keep track of any children that it creates (since they get
+ * traced whether we like it or not). */
+void Tracer::_handle_excluded(Tracee& tracee, int status)
+{
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        _remove_tracee(tracee);
+        return;
+    }
+    if (!WIFSTOPPED(status))
+    {
+        throw diagnose_bad_event(tracee, status,
+            "Tracee hasn't ended but also hasn't stopped...");
+    }
+    _set_state(tracee, Tracee::STOPPED);
+    if (tracee.awaitingInitialStop)
+    {
+        tracee.awaitingInitialStop = false;
+        _release(tracee);
+        return;
+    }
+
+    if (IS_FORK_EVENT(status) || IS_VFORK_EVENT(status) 
+        || IS_CLONE_EVENT(status) || IS_EXEC_EVENT(status))
+    {
+        unsigned long id; // the child, or the ID the execing thread had
+        if (PTRACE(PTRACE_GETEVENTMSG, tracee.pid, 0, (void *)&id) == -1) 
+        {
+            if (errno == ESRCH) 
+            {
+                _expect_ended(tracee);
+                return;
+            }
+            throw SystemError(errno, "ptrace(PTRACE_GETEVENTMSG)");
+        }
+        if (!IS_EXEC_EVENT(status))
+        {
+            // (This includes new threads, which we treat just the same.)
+            Tracee& child = _add_tracee(id, nullptr);
+            child.attached = tracee.attached;
+            child.excluded = true;
+            _set_state(child, Tracee::RUNNING);
+            child.awaitingInitialStop = true;
+            _claim_stops(id);
+        }
+        else if ((pid_t)id != tracee.pid)
+        {
+            // The execing thread's old ID is gone (see _handle_exec_event).
+            auto it = _tracees.find(id);
+            if (it != _tracees.end())
+            {
+                _remove_tracee(it->second);
+            }
+        }
+    }
+    else if (!IS_SECCOMP_EVENT(status) 
+        && !IS_SYSCALL_EVENT(status)
+        && !IS_STOP_EVENT(status))
+    {
+        // A signal, which we pass on - unless it's actually a group-stop (we
+        // can't get the siginfo for those).
+        siginfo_t info;
+        if (PTRACE(PTRACE_GETSIGINFO, tracee.pid, 0, &info) != -1)
+        {
+            tracee.signal = WSTOPSIG(status);
+        }
+        else if (errno == ESRCH)
+        {
+            _expect_ended(tracee);
+            return;
+        }
+        else if (errno != EINVAL)
+        {
+            throw SystemError(errno, "ptrace(PTRACE_GETSIGINFO)");
+        }
+    }
+    _resume(tracee);
+}
+
+/* Call this once an orphaned tracee has been reaped (by the reaper process, or
+ * by us if we're the subreaper, in which case we don't have any info). */
+void Tracer::_orphan(Tracee& tracee, std::optional<ReapInfo> info)
+{
+    log("{} orphaned", tracee.pid);
+    count_orphan();
+    if (info)
+    {
+        const struct rusage& usage = info->rusage;
+        debug("{} used {}.{:06}s user and {}.{:06}s system time", tracee.pid,
+            usage.ru_utime.tv_sec, usage.ru_utime.tv_usec, 
+            usage.ru_stime.tv_sec, usage.ru_stime.tv_usec);
+    }
+    tracee.process->notify_orphaned(std::move(info));
+    _remove_tracee(tracee);
+}
+
+Tracer::Tracer(Options opts) 
+    : _running(0), _blocked(0), _dead(0), _threads(0), _vforks(0), 
+    _lifecycleTracees(0), _lifecycle(opts.lifecycle), _inferredReaps(0),
+    _maxStopRate(opts.maxStopRate),
+    _seccomp(false), 
+    _subreaper(opts.subreaper), _maxDepth(opts.maxDepth), 
+    _maxProcesses(opts.maxProcesses), _onlySubtree(opts.onlySubtree), 
+    _processes(0), _detaches(0)
+{
+    if (_subreaper && prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
+    {
+        throw SystemError(errno, "prctl(PR_SET_CHILD_SUBREAPER)");
+    }
+    if (opts.seccomp)
+    {
+        _seccomp = seccomp_supported();
+        if (!_seccomp)
+        {
+            warning("This kernel doesn't support seccomp filters, so every "
+                "syscall will have to be traced (this will be slower).");
+        }
+    }
+}
+
+shared_ptr<ProcessTree> Tracer::start(string_view program, 
+                                      vector<string> argv) 
+{
+    std::scoped_lock<std::mutex> guard(_lock);
+    return _start(program, std::move(argv));
+}
+
+void Tracer::set_lifecycle(bool lifecycle)
+{
+    std::scoped_lock<std::mutex> guard(_lock);
+    _lifecycle = lifecycle;
+}
+
+shared_ptr<ProcessTree> Tracer::attach(pid_t pid)
+{
+    std::scoped_lock<std::mutex> guard(_lock);
+    return _attach(pid);
+}
+
+/* Does the actual work for start(). */
+shared_ptr<ProcessTree> Tracer::_start(string_view program, 
+                                       vector<string> argv)
+{
+    // Lifecycle tracees don't get the filter, since it would stop them at the
+    // filtered syscalls no matter how they were resumed.
+    pid_t pid = start_tracee(program, argv, _seccomp && !_lifecycle);
+    auto tree = std::make_shared<ProcessTree>();
+    _trees.push_back(tree);
+    Leader& leader = _leaders[pid] = Leader();
+    Tracee& tracee = _add_tracee(pid, &tree->add(pid, program, argv));
+    tracee.selected = _matches_subtree(argv);
+    if (_lifecycle)
+    {
+        tracee.lifecycle = true;
+        _lifecycleTracees++;
+    }
+    _processes++;
+
+    while (!leader.execed)
     {
+        // Search the map each time since it is possible that the leader has 
+        // ended and been removed and old references invalidated.
+        auto it = _tracees.find(pid);
+        if (it == _tracees.end())
+        {
+            throw std::runtime_error("Tracee ended before it could exec.");
+        }
+        _resume(it->second); // if this fails, we'll get the exit status below
         int status;
-        pid_t pid;
-        while ((pid = wait(&status)) != -1) 
+        if (waitpid(pid, &status, 0) == -1)
         {
-            std::scoped_lock<std::mutex> guard(_lock);
+            throw SystemError(errno, "waitpid");
+        }
+        _handle_wait_notification(it->second, status);
+    }
 
-            auto it = _tracees.find(pid);
-            if (it == _tracees.end())
+    return tree;
+}
+
+/* Does the actual work for attach(). We go through the tree from the top down,
+ * stopping each process (see _attach_process) before we look for its children,
+ * so nothing can get forked without us seeing it. Everything is left stopped
+ * until the next step. Any descendants that we can't attach to are left out
+ * (with a warning). */
+shared_ptr<ProcessTree> Tracer::_attach(pid_t pid)
+{
+    vector<string> args;
+    if (!get_cmdline(pid, args))
+    {
+        throw std::runtime_error(format("There's no process with PID {}.", pid));
+    }
+    if (args.empty())
+    {
+        // Kernel threads and zombies don't have any command line.
+        throw std::runtime_error(format("Can't attach to {}.", pid));
+    }
+    auto tree = std::make_shared<ProcessTree>();
+    Process& root = tree->add(pid, args[0], args);
+    _trees.push_back(tree); // before any tracees can point into it
+
+    // Statuses that turned up instead of the stops that we were waiting for.
+    // We only handle them once everything is attached (see _attach_process).
+    vector<std::pair<pid_t, int>> statuses;
+    bool matched = _matches_subtree(args);
+    if (!_attach_process(pid, root, 0, matched, statuses))
+    {
+        throw std::runtime_error("Process ended before we could attach to it.");
+    }
+    log("attached to {}", pid);
+
+    std::queue<Process*> queue;
+    queue.push(&root);
+    vector<pid_t> tids, children;
+    while (!queue.empty())
+    {
+        Process* parent = queue.front();
+        queue.pop();
+        size_t depth = 1;
+        bool selected = false;
+        auto it = _tracees.find(parent->pid());
+        if (it != _tracees.end())
+        {
+            depth = it->second.depth + 1;
+            selected = it->second.selected;
+        }
+        // The threads are all stopped now, so these lists can't change.
+        if (!get_threads(parent->pid(), tids))
+        {
+            continue;
+        }
+        for (pid_t tid : tids)
+        {
+            if (!get_children(parent->pid(), tid, children))
             {
-                warning("Got wait status \"{}\" for unknown PID {}.", 
-                    diagnose_wait_status(status), pid);
                 continue;
             }
+            for (pid_t child : children)
+            {
+                try
+                {
+                    if (!get_cmdline(child, args))
+                    {
+                        continue; // it's gone already
+                    }
+                    Process& process = args.empty()
+                        ? tree->add(child, *parent)
+                        : tree->add(child, *parent, args[0], args);
+                    if (_attach_process(child, process, depth, 
+                            selected || _matches_subtree(args), statuses))
+                    {
+                        parent->notify_forked(process);
+                        queue.push(&process);
+                    }
+                }
+                catch (const SystemError& e)
+                {
+                    warning("Couldn't attach to {}: {}", child, e.what());
+                }
+            }
+        }
+    }
 
-            _handle_wait_notification(it->second, status);
-            _collect_orphans();
+    for (auto [tid, status] : statuses)
+    {
+        _handle_wait_notification(tid, status);
+    }
+    return tree;
+}
 
-            if (_all_tracees_dead())
+/* Attaches to all the threads of a process for _attach, and waits for each of
+ * them to stop, so that they can't fork or create any more threads without us
+ * knowing. We don't set our usual options until then (see attach_tracee), so
+ * the ones that are already stopped can't do anything that would be reported
+ * to us either. Any threads that get created by ones that we haven't caught
+ * yet show up when we check the list again. The statuses of anything other 
+ * than the stops that we're after get added to `statuses`. Returns false if 
+ * the process is gone. */
+bool Tracer::_attach_process(pid_t pid, 
+                             Process& process,
+                             size_t depth,
+                             bool selected,
+                             vector<std::pair<pid_t, int>>& statuses)
+{
+    vector<pid_t> tids;
+    vector<pid_t> attached;
+    bool found = true;
+    while (found && get_threads(pid, tids))
+    {
+        found = false;
+        for (pid_t tid : tids)
+        {
+            if (_tracees.find(tid) != _tracees.end() || !attach_tracee(tid))
             {
-                break;
+                continue;
             }
-            if (!_are_tracees_running())
+            found = true;
+            attached.push_back(tid);
+            Tracee& tracee = _add_tracee(tid, &process);
+            tracee.tgid = pid;
+            tracee.attached = true;
+            tracee.depth = depth;
+            tracee.selected = selected;
+            if (_lifecycle)
             {
-                return true;
+                tracee.lifecycle = true;
+                _lifecycleTracees++;
+            }
+            if (tid != pid)
+            {
+                _threads++;
+                verbose("attached to {} thread {}", pid, tid);
+            }
+
+            int status;
+            if (waitpid(tid, &status, __WALL) == -1)
+            {
+                throw SystemError(errno, "waitpid");
+            }
+            if (!IS_STOP_EVENT(status))
+            {
+                // Either something else got in before our interrupt (which
+                // will still come later), or it ended. It's stopped either way.
+                statuses.emplace_back(tid, status);
             }
         }
     }
-    return !_tracees.empty(); // FIXME: mutex should be locked?!
+
+    for (pid_t tid : attached)
+    {
+        if (!finish_attaching(tid))
+        {
+            _expect_ended(_tracees.at(tid));
+        }
+    }
+    if (attached.empty())
+    {
+        return false;
+    }
+    _processes++;
+    return true;
 }
 
-void Tracer::notify_orphan(pid_t pid)
+/* We may get the initial stop of a new child before the fork event of its
+ * parent (since they're separate processes), in which case we don't know who
+ * the child is yet. So the step() loop stashes those away, and once we get the
+ * fork event and add the child's Tracee, this handles any stashed statuses. */
+void Tracer::_claim_stops(pid_t pid)
+{
+    for (size_t i = 0; i < _unclaimed.size(); )
+    {
+        if (_unclaimed[i].first != pid)
+        {
+            ++i;
+            continue;
+        }
+        int status = _unclaimed[i].second;
+        _unclaimed.erase(_unclaimed.begin() + i);
+
+        auto it = _tracees.find(pid);
+        assert(it != _tracees.end());
+        debug("{} claimed stashed wait status \"{}\"", 
+            pid, diagnose_wait_status(status));
+        _handle_wait_notification(it->second, status);
+    }
+}
+
+bool Tracer::_all_tracees_dead() const
+{
+    return _dead == _tracees.size();
+}
+
+bool Tracer::_can_hold_stops() const
+{
+    return _threads == 0 && _vforks == 0 && _lifecycleTracees == 0;
+}
+
+bool Tracer::_are_tracees_running(bool countBlocked) const
+{
+    return countBlocked ? _running > 0 : _running > _blocked;
+}
+
+Tracee& Tracer::_add_tracee(pid_t pid, Process* process)
+{
+    auto old = _tracees.find(pid);
+    if (old != _tracees.end())
+    {
+        // We got a new tracee with the same PID as an existing tracee. This is
+        // possible if the old tracee was orphaned and the reaper reaped it,
+        // but the system recycled the PID before we learnt about it. When we
+        // do get told, the start time won't match (see _collect_orphans).
+        debug("PID {} was recycled before we knew it was orphaned", pid);
+        _remove_tracee(old->second); // it ded
+    }
+    auto [it, good] = _tracees.emplace(pid, Tracee(pid, process));
+    assert(good); // good is true if the key was vacant
+    if (!get_start_time(pid, it->second.startTime))
+    {
+        it->second.startTime = 0; // it's gone already, we'll find out soon
+    }
+    _count(it->second, +1);
+    return it->second;
+}
+
+void Tracer::_remove_tracee(Tracee& tracee)
+{
+    if (_subreaper)
+    {
+        auto it = std::find(_vanished.begin(), _vanished.end(), tracee.pid);
+        if (it != _vanished.end())
+        {
+            _vanished.erase(it); // its parent reaped it after all
+        }
+        _reaps.erase(tracee.pid);
+    }
+    if (tracee.pid != tracee.tgid)
+    {
+        _threads--;
+    }
+    if (tracee.lifecycle)
+    {
+        _lifecycleTracees--;
+    }
+    _count(tracee, -1);
+    pid_t pid = tracee.pid; // since erase would be using a dangling reference
+    _tracees.erase(pid);
+}
+
+void Tracer::_handle_wait_notification(pid_t pid, int status)
+{
+    auto it = _tracees.find(pid);
+    if (it == _tracees.end() && _subreaper 
+        && (_detaches > 0 || _inferredReaps > 0)
+        && (WIFEXITED(status) || WIFSIGNALED(status)))
+    {
+        // Something from a subtree that we left out (see _exclude) that got
+        // orphaned and passed on to us (or see _infer_reaps).
+        debug("reaped untraced orphan {}", pid);
+        _reaps.erase(pid);
+        return;
+    }
+    if (it == _tracees.end())
+    {
+        // Probably a new child whose parent's fork event hasn't been handled
+        // yet. See _claim_stops.
+        debug("Stashing wait status \"{}\" for unknown PID {}.", 
+            diagnose_wait_status(status), pid);
+        _unclaimed.emplace_back(pid, status);
+        return;
+    }
+    _handle_wait_notification(it->second, status);
+}
+
+/* Handles the wait statuses in _statuses (in the order that we got them). */
+void Tracer::_handle_statuses()
+{
+    while (!_statuses.empty())
+    {
+        auto [pid, status] = _statuses.front();
+        _statuses.pop(); // first, in case it throws
+        _handle_wait_notification(pid, status);
+    }
+}
+
+bool Tracer::step() 
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_tracees.empty())
+    {
+        return false; // no tracees left
+    }
+    _handle_statuses(); // anything left over if the last step threw
+    for (auto& [pid, tracee] : _tracees) 
+    {
+        _resume(tracee);
+    }
+    _collect_orphans();
+    if (_subreaper && !_are_tracees_running())
+    {
+        _reap_orphans(); // since we won't be waiting for anything below
+    }
+
+    // We only want to wait if we know there's something to wait for. If we're
+    // not careful with that, then we could end up blocking forever.
+    vector<std::pair<pid_t, int>> batch;
+    vector<std::pair<pid_t, ReapInfo>> reaps;
+    while (_are_tracees_running())
+    {
+        // We don't want the mutex locked while we wait since the wait is a
+        // blocking call and we don't want to keep it locked unnecessarily.
+        guard.unlock();
+        bool ok = wait_for_batch(batch, __WALL, _subreaper ? &reaps : nullptr);
+        guard.lock();
+        if (!ok)
+        {
+            break;
+        }
+        for (auto& pair : batch)
+        {
+            _statuses.push(pair);
+        }
+        for (auto& [pid, info] : reaps)
+        {
+            _reaps[pid] = info;
+        }
+        _handle_statuses();
+        _collect_orphans();
+
+        if (_all_tracees_dead())
+        {
+            break;
+        }
+        // Tracees that are blocked in a call (e.g., waiting for a child)
+        // don't count, since they may be blocked on a tracee that has
+        // just stopped (which won't be resumed until the next step).
+        if (!_are_tracees_running(false))
+        {
+            return true;
+        }
+    }
+    return !_tracees.empty();
+}
+
+void Tracer::notify_orphan(pid_t pid, ReapInfo info)
 {
     std::scoped_lock<std::mutex> guard(_lock);
-    _orphans.push(pid);
+    _orphans.emplace(pid, std::move(info));
+}
+
+void Tracer::notify_orphans_lost(string reason)
+{
+    std::scoped_lock<std::mutex> guard(_lock);
+    _orphansLost = std::move(reason);
 }
 
 void Tracer::check_orphans()
@@ -1131,7 +2525,6 @@ void Tracer::nuke()
     }
     //while (step()) { }
     //assert(_tracees.empty());
-    //assert(_recycledPIDs.empty()); // TODO ??
 }
 
 void Tracer::print_list() const 
@@ -1139,6 +2532,11 @@ void Tracer::print_list() const
     std::scoped_lock<std::mutex> guard(_lock);
     for (auto& [pid, tracee] : _tracees) 
     {
+        if (tracee.excluded)
+        {
+            std::cerr << format("{} excluded\n", pid);
+            continue;
+        }
         std::cerr << format("{} {} {}\n", 
             pid, tracee.process->state(), tracee.process->command_line());
     }
@@ -1148,12 +2546,5 @@ void Tracer::print_list() const
 bool Tracer::tracees_alive() const
 {
     std::scoped_lock<std::mutex> guard(_lock);
-    for (auto& pair : _tracees)
-    {
-        if (pair.second.state != Tracee::DEAD)
-        {
-            return true; // TODO use counters instead?
-        }
-    }
-    return false;
+    return _dead < _tracees.size();
 }
@@ -12,9 +12,16 @@
 #include <vector>
 #include <mutex>
 #include <queue>
+#include <optional>
 #include <functional>
+#include <regex>
+#include <chrono>
+
+#include "memory.hpp"
+#include "system.hpp"
 
 class Process; // defined in process.hpp
+class ProcessTree; // defined in process.hpp
 struct Tracee;
 class Tracer;
 class BlockingCall; // defined in tracer.cpp
@@ -57,15 +64,30 @@ struct Tracee
         DEAD,
     };
 
-    pid_t pid;
+    pid_t pid;      // Actually the thread ID (each thread has its own Tracee)
+    pid_t tgid;     // The thread group (process) ID - same as pid for a leader
     State state;
     int syscall;    // Current syscall, SYSCALL_NONE if not in one
     int signal;     // Pending signal to be delivered when next resumed
+    bool awaitingInitialStop; // New child that hasn't hit its SIGSTOP yet
+    bool attached;  // Part of a tree that we attached to (see Tracer::attach)
+    bool lifecycle; // Only forks/execs/exits traced (see Options::lifecycle)
+    bool excluded;  // Left out of the trace (see Tracer::_exclude)
+    bool selected;  // Inside a subtree picked by Options::onlySubtree
+    size_t depth;   // How far down the process tree we are (the root is 0)
+    unsigned long long startTime; // With the pid, identifies us (0 if unknown)
+    size_t stops;   // How many times we've stopped for the tracer altogether
+    std::chrono::steady_clock::time_point stoppedAt; // (see Tracer::_set_state)
+    size_t windowStops; // Stops by us and our children since windowStart
+    std::chrono::steady_clock::time_point windowStart; // (see _meter_stop)
+    bool throttled; // Going to be switched to lifecycle tracing (see _throttle)
     std::unique_ptr<BlockingCall> blockingCall;
-    std::shared_ptr<Process> process;
+    Process* process; // in one of Tracer::_trees, so it can't go away on us
+    TraceeMemory memory; // for reading strings etc. out of the tracee
 
-    /* Create a tracee started in the stopped state */
-    Tracee(pid_t pid, std::shared_ptr<Process> process);
+    /* Create a tracee started in the stopped state (as its own thread group
+     * leader - set tgid afterwards for other threads). */
+    Tracee(pid_t pid, Process* process);
 
     /* Move constructor needed in some cases (or else STL gibberish ensues). */
     Tracee(Tracee&&);
@@ -77,11 +99,70 @@ struct Tracee
 /* All the public member functions are "thread-safe". */
 class Tracer 
 {
+public:
+    struct Options
+    {
+        /* If true (and the kernel supports it), tracees are started with a
+         * seccomp filter so that they only stop for the syscalls we care about
+         * instead of stopping at the entry and exit of every single syscall.
+         * See start_tracee in ptrace.hpp. */
+        bool seccomp = true;
+
+        /* If true, then we make ourselves a subreaper (see prctl(2)), so that
+         * orphaned tracees get passed on to us, and we find out about them in
+         * the same wait loop as everything else (so notify_orphan isn't used).
+         * Otherwise, someone else has to be the subreaper and notify us. */
+        bool subreaper = false;
+
+        /* Limits on what gets traced, for when only part of a process tree is
+         * of interest (or it's too big to trace the whole thing). A child that
+         * would be deeper than maxDepth (the root is at depth 0), or that
+         * would take the number of processes we've traced past maxProcesses,
+         * gets left out when it's forked, along with everything that it goes
+         * on to create. If there's an onlySubtree regex, then a process that
+         * execs a program (the arguments are matched, separated by spaces)
+         * that doesn't match gets left out, unless it's already in the subtree
+         * of one that did match. The root, and processes that have forked
+         * already, are never left out. Anything that's left out shows up as a
+         * DetachEvent in the process tree, and runs at full speed from then
+         * on. */
+        size_t maxDepth = SIZE_MAX;
+        size_t maxProcesses = SIZE_MAX;
+        std::optional<std::regex> onlySubtree;
+
+        /* If true, then new trees are only traced for their forks, execs and
+         * exits, which the kernel reports as ptrace events. The tracees are
+         * resumed with PTRACE_CONT (without the seccomp filter), so they never
+         * stop for a syscall at all - but we don't see any waits or kills, or
+         * anything else that needs a syscall-stop. Reaps get worked out from
+         * the order in which things disappear instead (see _infer_reaps), and
+         * orphans are still found out about in the usual way. This can also be
+         * changed with set_lifecycle (it only affects trees started after). */
+        bool lifecycle = false;
+
+        /* If this isn't 0, then it's a budget on how many times per second any
+         * process, together with its children, can stop for us (stops are
+         * what slow the tracees down). A process that goes over it gets its
+         * whole subtree switched to lifecycle tracing (see above) from then
+         * on, with a DowngradeEvent to mark where that happened. Stops only
+         * count against the process that stopped and its parent, so the root
+         * (or anything else) only gets downgraded if it or its own children 
+         * stop too often - a busy grandchild doesn't downgrade the root. This
+         * puts a bound on how much slower we can make any one process, at the
+         * cost of not seeing everything. */
+        size_t maxStopRate = 0;
+    };
+
 private:
-    /* This class is defined in tracer.cpp and needs access to us to help
-     * handle a successful wait call. I could make public member functions
-     * for that but I don't want to expose those functions to everyone. */
-    template<class, bool, int> friend class WaitCall;
+    /* These classes are defined in tracer.cpp and need access to us to help
+     * handle the syscalls that they track (e.g., a successful wait call). I
+     * could make public member functions for that but I don't want to expose
+     * those functions to everyone. */
+    template<class, bool> friend class WaitCall;
+    friend class ForkCall;
+    friend class ThreadCall;
+    friend class ExecveCall;
+    friend class KillCall;
 
     /* We use a single lock for everything to keep it all simple. Currently,
      * only the public functions lock it - private functions are all unlocked
@@ -92,14 +173,18 @@ private:
 
     /* Keep track of the processes that are currently active. By 'active', I
      * mean the process is either currently running or is a zombie (i.e., the
-     * pid is not available for recycling yet). */
+     * pid is not available for recycling yet). Threads get their own entries
+     * (keyed by thread ID), which share their thread group's Process. */
     std::unordered_map<pid_t, Tracee> _tracees;
 
     /* A queue of all the orphans that we've been notified about. We don't
      * handle them straight away since notify_orphan may be called from a
      * separate thread and we want to be able to print error messages and
      * throw exceptions in the main thread that calls step(). */
-    std::queue<pid_t> _orphans;
+    std::queue<std::pair<pid_t, ReapInfo>> _orphans;
+
+    /* Set by notify_orphans_lost (for the same reason as above). */
+    std::optional<std::string> _orphansLost;
     
     struct Leader
     {
@@ -109,39 +194,148 @@ private:
 
     /* Keep track of the PIDs of our direct children. */
     std::unordered_map<pid_t, Leader> _leaders;
-    
-    /* Stores PIDs that have been recycled by the system. This can occur when
-     * the reaper process reaps a tracee, but then the system recycles its PID
-     * before we get notified about it. Each time we encounter a recycled PID,
-     * we pop it onto the end of this vector. When collecting PIDs of orphans,
-     * we then check this vector first, to make sure we don't get confused into
-     * thinking that a currently running process has been orphaned. */
-    std::vector<pid_t> _recycledPIDs;
+
+    /* Every tree that we've started or attached to. We hang on to these (as
+     * well as whoever we gave them to) since the tracees point into them. */
+    std::vector<std::shared_ptr<ProcessTree>> _trees;
+
+    /* Wait statuses for PIDs that we didn't know about when we got them (in
+     * the order that we got them). See _claim_stops. */
+    std::vector<std::pair<pid_t, int>> _unclaimed;
+
+    /* Wait statuses that step() has collected but hasn't handled yet. It grabs
+     * all the ones that are ready in one go (see wait_for_batch), so if one of
+     * them throws, we keep the rest here to handle at the start of the next
+     * step. */
+    std::queue<std::pair<pid_t, int>> _statuses;
+
+    /* How many of the tracees are RUNNING, how many of those are blocked in a
+     * call that could take forever (see BlockingCall::blocking), and how many
+     * are DEAD. step() checks these after every batch of wait statuses, which
+     * beats going through every tracee each time when there are thousands of
+     * them. These are kept up to date by _set_state, _set_call, _add_tracee
+     * and _remove_tracee, so only ever use those to change a tracee. */
+    size_t _running;
+    size_t _blocked;
+    size_t _dead;
+
+    /* How many of the tracees are threads other than a thread group leader.
+     * Normally, new children and tracees that just forked/execed/killed are
+     * left stopped until the next step (so that a step doesn't run on past
+     * them), and the step is over once everyone else is stopped or blocked.
+     * But other threads could be waiting for those ones in ways that we can't
+     * see (e.g., a futex), so the step might never end. So we don't hold
+     * anyone back while there are any threads (see _can_hold_stops). The same
+     * goes for parents in the middle of a vfork (they wait for the child to
+     * exec or exit, which it can't do while it's being held back). */
+    size_t _threads;
+    size_t _vforks;
+
+    /* How many of the tracees are only being traced for their lifecycle (see
+     * the Options). We can't see them wait for anyone at all, so it's the same
+     * deal as with threads. _lifecycle is what new trees get. */
+    size_t _lifecycleTracees;
+    bool _lifecycle;
+
+    /* Tracees that ended while we were only tracing their lifecycle, and that
+     * we haven't seen get reaped yet (see _infer_reaps), along with when we're
+     * going to give up on hearing that they were orphaned (which is only set
+     * once their parent has ended too). _inferredReaps counts how many reaps
+     * we've had to guess. */
+    std::vector<std::pair<pid_t, std::chrono::steady_clock::time_point>> 
+        _unreaped;
+    size_t _inferredReaps;
+
+    /* See Options::maxStopRate. */
+    size_t _maxStopRate;
+
+    /* Are tracees being started with the seccomp filter? This is only true if
+     * it was requested in the Options and the kernel actually supports it. If
+     * this is true, then tracees are resumed with PTRACE_CONT whenever they
+     * are not inside a syscall that we're keeping track of. */
+    bool _seccomp;
+
+    /* Are we the subreaper for our tracees? (See the Options). If so, then
+     * _vanished is a list of tracees that have ended and then disappeared
+     * before we worked out who reaped them (see _check_reaped), and _reaps has
+     * what wait4 told us when we got the exit statuses of tracees that are
+     * still around (see wait_for_batch), for if it turns out that we reaped
+     * them ourselves (in which case, it goes in their Process::reap_info). */
+    bool _subreaper;
+    std::vector<pid_t> _vanished;
+    std::unordered_map<pid_t, ReapInfo> _reaps;
+
+    /* See the Options. _processes is how many processes we've traced so far,
+     * and _detaches is how many subtrees we've left out. The Processes of the
+     * ones that we've left out are kept here until their parents reap them
+     * (see _exclude), along with their start times, since we can't tell when
+     * they end and their PIDs could get recycled in the meantime. */
+    struct Detached
+    {
+        Process* process;
+        unsigned long long startTime; // 0 if we didn't know it
+    };
+    size_t _maxDepth;
+    size_t _maxProcesses;
+    std::optional<std::regex> _onlySubtree;
+    size_t _processes;
+    size_t _detaches;
+    std::unordered_map<pid_t, Detached> _detached;
 
     /* Private functions, see source file */
     void _collect_orphans();
-    bool _are_tracees_running() const;
+    bool _are_tracees_running(bool countBlocked = true) const;
     bool _all_tracees_dead() const;
+    bool _can_hold_stops() const;
     bool _resume(Tracee&);
-    bool _wait_for_stop(Tracee&, int&);
     void _handle_wait_notification(pid_t, int);
     void _handle_wait_notification(Tracee&, int);
     void _handle_syscall_entry(Tracee&, int, size_t[]);
-    void _handle_syscall_exit(Tracee&);
-    void _handle_fork(Tracee&);
-    void _handle_failed_fork(Tracee&);
+    void _handle_syscall_exit(Tracee&, size_t);
+    void _handle_fork(Tracee&, bool);
+    void _handle_clone(Tracee&, uint64_t, int);
+    void _handle_clone3(Tracee&, const void*);
+    bool _handle_exec_event(Tracee&);
+    bool _handle_lifecycle_event(Tracee&, int);
+    void _infer_reaps();
+    void _meter_stop(Tracee&);
+    void _throttle(Tracee&, size_t rate);
     void _handle_exec(Tracee&, const char*, const char**);
     void _handle_kill(Tracee&, pid_t, int, bool);
     void _handle_new_location(Tracee&, unsigned, const char*, const char*);
     void _handle_signal_stop(Tracee&, int);
     void _handle_stopped(Tracee&, int);
-    Tracee& _add_tracee(pid_t, std::shared_ptr<Process>);
+    Tracee& _add_tracee(pid_t, Process*);
+    void _remove_tracee(Tracee&);
+    void _set_state(Tracee&, Tracee::State);
+    std::unique_ptr<BlockingCall> _set_call(Tracee&, 
+                                            std::unique_ptr<BlockingCall>);
+    void _count(const Tracee&, int);
+    void _handle_statuses();
+    void _check_reaped(Tracee&);
+    std::optional<ReapInfo> _our_reap(const Tracee&) const;
+    void _orphan(Tracee&, std::optional<ReapInfo>);
+    void _reap_orphans();
     void _expect_ended(Tracee&);
-    void _initiate_wait(Tracee&, std::unique_ptr<BlockingCall>);
+    bool _initiate_call(Tracee&, std::unique_ptr<BlockingCall>);
+    void _claim_stops(pid_t);
     void _on_sent_signal(Tracee&, pid_t, int, bool);
+    std::shared_ptr<ProcessTree> _start(std::string_view, 
+                                        std::vector<std::string>);
+    std::shared_ptr<ProcessTree> _attach(pid_t);
+    bool _attach_process(pid_t, Process&, size_t depth, bool selected,
+                         std::vector<std::pair<pid_t, int>>&);
+    void _handle_attached_end(Tracee&);
+    bool _over_limits(const Tracee&) const;
+    bool _matches_subtree(const std::vector<std::string>&) const;
+    bool _check_subtree(Tracee&, const std::vector<std::string>&);
+    void _exclude(Tracee&);
+    void _release(Tracee&);
+    void _handle_excluded(Tracee&, int);
 
 public:
-    Tracer() { }
+    Tracer() : Tracer(Options()) { }
+    Tracer(Options opts);
 
     Tracer(const Tracer&) = delete;
     Tracer(Tracer&&) = delete;
@@ -151,8 +345,20 @@ public:
      * for the program. This tracee will become our child and the new leader 
      * process. The args list includes argv[0]. Throws either a SystemError
      * or runtime_error on failure. */
-    std::shared_ptr<Process> start(std::string_view path, 
-                                   std::vector<std::string> argv);
+    std::shared_ptr<ProcessTree> start(std::string_view path, 
+                                       std::vector<std::string> argv);
+
+    /* Start tracing a process that's already running (and all of its threads
+     * and descendants), using PTRACE_SEIZE. It won't be our child, so someone
+     * else will reap it. The ProcessTree that this returns starts from now,
+     * with the existing descendants showing up as forks at the start. Throws
+     * either a SystemError (e.g., EPERM if we aren't allowed to trace it) or
+     * runtime_error on failure. */
+    std::shared_ptr<ProcessTree> attach(pid_t pid);
+
+    /* Changes Options::lifecycle for any trees started (or attached to) from
+     * now on. */
+    void set_lifecycle(bool lifecycle);
 
     /* Continue all tracees until they all stop. Returns true if there are any
      * tracees remaining (whether they are alive or dead) - e.g., if there are
@@ -161,8 +367,19 @@ public:
     bool step();
 
     /* Notify the tracer that an orphan has been reaped by the reaper process.
-     * This function is safe to call from a separate thread. */
-    void notify_orphan(pid_t pid);
+     * This function is safe to call from a separate thread. (Not needed if we
+     * are the subreaper ourselves - see the Options). The info ends up in the
+     * orphan's Process (see Process::reap_info), and its start time is used to
+     * make sure that it's about the tracee that we think it is (in case the
+     * PID got recycled before we got this). */
+    void notify_orphan(pid_t pid, ReapInfo info);
+
+    /* Tells the tracer that it won't be notified about orphans anymore (e.g.,
+     * if the reaper process sent something that we can't read), so the trace
+     * can't be finished properly. Every step() from then on will throw a
+     * runtime_error with `reason` in it. Safe to call from a separate thread.
+     */
+    void notify_orphans_lost(std::string reason);
 
     /* Will ask the tracer to check if it has recently been notified of any
      * orphans and if it has, to handle those now (instead of later). We use